@@ -0,0 +1,220 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "arena.h"
+
+enum {
+    /** The size of each chunk an arena takes from the heap. Big
+     *  enough that even huge documents only need a few thousand of
+     *  them, small enough that a tiny document doesn't waste much. */
+    ar_chunk_size = 256 * 1024,
+
+    /** Allocations bigger than this get a chunk all to themselves,
+     *  rather than wasting what's left of the current one. */
+    ar_big_size = ar_chunk_size / 8
+};
+
+/** Anything that needs aligning is aligned as strictly as the most
+ *  demanding of these. This is C99's stand-in for max_align_t. */
+typedef union aralign {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*fp)( void );
+} aralign;
+
+/** Just a way to learn the alignment of an aralign, as C99 has no
+ *  alignof. */
+typedef struct arprobe {
+    char c;
+    aralign a;
+} arprobe;
+
+enum {
+    /** The alignment of everything from aralloc(). */
+    ar_align = offsetof( arprobe, a )
+};
+
+/** The header at the front of every chunk. The data follows it,
+ *  suitably aligned. */
+typedef struct archunk {
+    struct archunk *next;       /**< The chunk allocated before this one */
+    bool big;                   /**< Holds just one big allocation */
+    aralign data[];             /**< Where the allocations live */
+} archunk;
+
+/** Create a new empty arena and return a pointer to it. This function
+ *  never returns if it cannot allocate the requested memory. */
+arena *
+arnew()
+{
+    arena *a = emalloc( sizeof( *a ));
+    *a = (arena){ 0 };
+    return a;
+}
+
+/** Return every chunk of an arena back to the system, leaving the
+ *  arena itself still valid (though empty). Everything ever allocated
+ *  from it is gone in one fell swoop. */
+arena *
+arclear( arena *a )
+{
+    arreset( a );
+    for( archunk *c = a->spare, *next; c; c = next ) {
+        next = c->next;
+        free( c );
+    }
+    *a = (arena){ 0 };
+    return a;
+}
+
+/** Just like arclear(), everything ever allocated from \a a is gone,
+ *  but rather than giving its chunks back to the system, we hang on
+ *  to them for the allocations to come. An arena that's reset over
+ *  and over again, once for each of a long series of small documents,
+ *  say, soon stops going to the heap at all. Only the chunks of big
+ *  allocations are actually freed. */
+arena *
+arreset( arena *a )
+{
+    for( archunk *c = a->c, *next; c; c = next ) {
+        next = c->next;
+        if( c->big )
+            free( c );
+        else {
+            c->next = a->spare;
+            a->spare = c;
+        }
+    }
+    a->c = 0;
+    a->p = a->end = 0;
+    return a;
+}
+
+/** Hand everything allocated from \a from over to \a a, to be released
+ *  along with it, leaving \a from empty but still valid. Its chunks are
+ *  tucked in behind the current one of \a a, just as big allocations
+ *  are, so that \a a carries on allocating where it was; \a from's
+ *  spare chunks are simply freed. */
+arena *
+armerge( arena *a, arena *from )
+{
+    archunk *last = from->c;
+
+    if( last ) {
+        while( last->next )
+            last = last->next;
+        if( a->c ) {
+            last->next = a->c->next;
+            a->c->next = from->c;
+        } else {
+            a->c = from->c;
+            a->p = from->p;
+            a->end = from->end;
+        }
+        from->c = 0;
+        from->p = from->end = 0;
+    }
+    arclear( from );
+    return a;
+}
+
+/** Release an arena obtained via arnew() and all of its memory. Once
+ *  you've called this, \a a is no longer valid. */
+void
+ardel( arena *a )
+{
+    free( arclear( a ));
+}
+
+/** Round \a p up to the next multiple of \a align, which must be a
+ *  power of two. */
+static char *
+alignup( char *p, size_t align )
+{
+    return (char *)(( (uintptr_t)p + align - 1 ) & ~(uintptr_t)( align - 1 ));
+}
+
+/** Allocate a fresh chunk big enough for \a nb bytes, aligned to \a
+ *  align. Usually that's a regular chunk that becomes the current one.
+ *  A big allocation gets a chunk of its own, tucked in behind the
+ *  current one so that the space left in that one isn't lost. */
+static void *
+archunk_take( arena *a, size_t align, size_t nb )
+{
+    if( nb + align > ar_big_size ) {
+        archunk *c = emalloc( sizeof( *c ) + nb + align - 1 );
+        c->big = true;
+        if( a->c ) {
+            c->next = a->c->next;
+            a->c->next = c;
+        } else {
+            c->next = 0;
+            a->c = c;
+        }
+        return alignup( (char *)c->data, align );
+    }
+
+    archunk *c = a->spare;
+    if( c )
+        a->spare = c->next;
+    else {
+        c = emalloc( sizeof( *c ) + ar_chunk_size );
+        c->big = false;
+    }
+    c->next = a->c;
+    a->c = c;
+
+    char *p = alignup( (char *)c->data, align );
+    a->p = p + nb;
+    a->end = (char *)c->data + ar_chunk_size;
+    return p;
+}
+
+/** Allocate \a nb bytes from an arena, aligned to a multiple of \a
+ *  align bytes, which must be a power of two. Just like
+ *  posix_memalign(3), only simpler to call. Does not return if the
+ *  memory can't be had. */
+void *
+armemalign( arena *a, size_t align, size_t nb )
+{
+    char *p = alignup( a->p, align );
+
+    if( a->p && p <= a->end && nb <= (size_t)( a->end - p )) {
+        a->p = p + nb;
+        return p;
+    }
+    return archunk_take( a, align, nb );
+}
+
+/** Allocate \a nb bytes from an arena, aligned for any kind of data,
+ *  just like malloc(3). Does not return if the memory can't be had. */
+void *
+aralloc( arena *a, size_t nb )
+{
+    return armemalign( a, ar_align, nb );
+}
+
+/** Copy \a nb bytes from \a s into an arena, adding a terminating
+ *  null. This is the usual way to keep a string in an arena; there's
+ *  no alignment to pay for. */
+char *
+ardup( arena *a, const char *s, size_t nb )
+{
+    char *p;
+
+    if( a->p && nb < (size_t)( a->end - a->p )) {
+        p = a->p;
+        a->p += nb + 1;
+    } else
+        p = archunk_take( a, 1, nb + 1 );
+
+    memcpy( p, s, nb );
+    p[nb] = 0;
+    return p;
+}
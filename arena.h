@@ -0,0 +1,47 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_arena_h
+#define jsoncvt_arena_h
+#pragma once
+#include <stddef.h>
+
+/** An arena is a region of memory that hands out allocations by
+ *  simply bumping a pointer through large chunks obtained from the
+ *  heap. Nothing allocated from an arena is ever freed on its own;
+ *  instead, the whole arena is released at once, which is just a walk
+ *  down its short list of chunks. This suits things like a parse
+ *  tree, whose parts all live exactly as long as the tree does.
+ *
+ *  Expected usage is something like
+ *
+ *  1. Obtain a new arena via arnew(), or initialize one to all zeroes.
+ *
+ *  2. Use aralloc() for anything that needs the usual alignment,
+ *  armemalign() for anything that needs more, and ardup() for copies
+ *  of strings and other bytes.
+ *
+ *  3. Release everything allocated so far via arclear(), leaving the
+ *  arena empty but still valid. If the arena is going to be used
+ *  again, arreset() does the same, but keeps the memory for reuse.
+ *
+ *  4. if you called arnew() earlier, call ardel() to free it.
+ *
+ *  An arena isn't safe to allocate from in more than one thread at a
+ *  time. Threads that build parts of the same thing can each have an
+ *  arena of their own instead, and armerge() them into one after. */
+typedef struct arena {
+    struct archunk *c;          /**< Chunks, most recent first */
+    struct archunk *spare;      /**< Chunks kept by arreset() */
+    char *p;                    /**< Next free byte in the current chunk */
+    char *end;                  /**< End of the current chunk */
+} arena;
+
+extern arena *arnew();
+extern arena *arclear( arena * );
+extern arena *arreset( arena * );
+extern void ardel( arena * );
+extern void *aralloc( arena *, size_t );
+extern void *armemalign( arena *, size_t, size_t );
+extern char *ardup( arena *, const char *, size_t );
+extern arena *armerge( arena *, arena * );
+
+#endif
@@ -0,0 +1,65 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_bench_h
+#define jsoncvt_bench_h
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+/** What every benchmark in bench/ has in common: a clock, a way of
+ *  timing something over and over, and a way of reporting it, all so
+ *  that one commit can be held up against another. Everything times
+ *  the best of several runs, after one to warm up, since the best is
+ *  the one least disturbed by whatever else the machine was doing. */
+
+enum {
+    /** How many times bmtime() runs something, not counting the one
+     *  to warm up. */
+    bm_reps = 10
+};
+
+/** Returns the current time, in nanoseconds. */
+static inline double
+bmnow( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Run \a fn on \a arg #bm_reps times, after once to warm up, and
+ *  return the best time it took, in nanoseconds. */
+static inline double
+bmtime( void (*fn)( void * ), void *arg )
+{
+    double best = 0;
+
+    for( int r = 0; r <= bm_reps; ++r ) {
+        double t = bmnow();
+        (*fn)( arg );
+        t = bmnow() - t;
+        if( r && ( !best || t < best ))
+            best = t;
+    }
+    return best;
+}
+
+/** Print the heading for bmreport(). */
+static inline void
+bmheading( void )
+{
+    printf( "%-10s %-16s %10s %10s\n", "input", "what", "ns/op", "MB/s" );
+}
+
+/** Report that doing \a what to \a in took \a ns nanoseconds at best,
+ *  for \a ops operations over \a bytes bytes. */
+static inline void
+bmreport( const char *in, const char *what, double ns, size_t ops,
+          size_t bytes )
+{
+    printf( "%-10s %-16s %10.2f %10.1f\n", in, what, ns / ops,
+            bytes / ns * 1e3 );
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "twine.h"
+#include "ptrvec.h"
+#include "bench.h"
+
+/* How much it costs to build up the strings and vectors that the
+ * parser builds as it goes: a twine a byte, a word, or a character at
+ * a time, and a ptrvec a pointer at a time. Each starts out empty,
+ * just as they do in the parser, so growing them is part of the
+ * cost. */
+
+enum {
+    /** How many things are added in each run. */
+    bb_ops = 4 * 1000 * 1000
+};
+
+/** The code points handed to twaddu(): one, two, and three bytes of
+ *  UTF-8 apiece, which is six bytes for the lot. */
+static const uint32_t points[] = { 'a', 0xe9, 0x4e2d };
+
+/** What each run adds up, so that none of it is optimized away. */
+static volatile size_t sink;
+
+/** Add #bb_ops bytes to a twine with twaddc(). */
+static void
+addc( void *arg )
+{
+    twine tw = (twine){ 0 };
+
+    (void)arg;
+    for( size_t i = 0; i < bb_ops; ++i )
+        twaddc( &tw, 'a' + i % 26 );
+    sink += tw.len;
+    twclear( &tw );
+}
+
+/** Add #bb_ops words to a twine with twaddz(). */
+static void
+addz( void *arg )
+{
+    twine tw = (twine){ 0 };
+
+    (void)arg;
+    for( size_t i = 0; i < bb_ops; ++i )
+        twaddz( &tw, "member_" );
+    sink += tw.len;
+    twclear( &tw );
+}
+
+/** Add #bb_ops characters to a twine with twaddu(). */
+static void
+addu( void *arg )
+{
+    twine tw = (twine){ 0 };
+
+    (void)arg;
+    for( size_t i = 0; i < bb_ops; ++i )
+        twaddu( &tw, points[ i % 3 ] );
+    sink += tw.len;
+    twclear( &tw );
+}
+
+/** Add #bb_ops pointers to a ptrvec with pvadd(). */
+static void
+addp( void *arg )
+{
+    ptrvec pv = (ptrvec){ 0 };
+
+    for( size_t i = 0; i < bb_ops; ++i )
+        pvadd( &pv, (char *)arg + i );
+    sink += pv.len;
+    pvclear( &pv );
+}
+
+int
+main( void )
+{
+    static char base[1];
+
+    bmheading();
+    bmreport( "bytes", "twaddc", bmtime( addc, 0 ), bb_ops, bb_ops );
+    bmreport( "words", "twaddz", bmtime( addz, 0 ), bb_ops, 7 * bb_ops );
+    bmreport( "utf8", "twaddu", bmtime( addu, 0 ), bb_ops, 2 * bb_ops );
+    bmreport( "pointers", "pvadd", bmtime( addp, base ), bb_ops,
+              bb_ops * sizeof( void * ));
+    return 0;
+}
@@ -0,0 +1,224 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "twine.h"
+#include "obuf.h"
+#include "scan.h"
+#include "json.h"
+#include "xml.h"
+#include "ksh.h"
+#include "bench.h"
+
+/* How much it costs, per byte of string, to find what needs escaping
+ * in the output, and to write a string out in its entirety, for each
+ * of our writers. Three kinds of strings are tried: plain ASCII text,
+ * which hardly ever needs escaping; text thick with the characters
+ * that XML writes as entities; and UTF-8 text that's mostly outside
+ * of ASCII, every byte of which ksh writes as a hex escape. */
+
+enum {
+    /** The size of each string we time. */
+    eb_size = 1024 * 1024,
+
+    /** How many times each is timed; we report the best. */
+    eb_reps = 20
+};
+
+/** Fill \a p with \a n bytes of plain ASCII text. */
+static void
+ascii( char *p, size_t n )
+{
+    static const char words[] = "the quick brown fox jumps over a lazy "
+        "dog, then does it again; 0123456789 times (or so) ";
+
+    for( size_t i = 0; i < n; ++i )
+        p[i] = words[ i % ( sizeof( words ) - 1 ) ];
+}
+
+/** Fill \a p with \a n bytes of text, one in four of them an entity in
+ *  XML. */
+static void
+entity( char *p, size_t n )
+{
+    static const char ents[] = "<>&'\"";
+
+    ascii( p, n );
+    for( size_t i = 3; i < n; i += 4 )
+        p[i] = ents[ i / 4 % ( sizeof( ents ) - 1 ) ];
+}
+
+/** Fill \a p with \a n bytes of UTF-8 text, mostly outside of ASCII,
+ *  ending on a whole character. */
+static void
+utf8( char *p, size_t n )
+{
+    static const char text[] = "héllo wörld, 中文字符 ещё текст ";
+    size_t i = 0, len = sizeof( text ) - 1;
+
+    while( i + len <= n ) {
+        memcpy( p + i, text, len );
+        i += len;
+    }
+    memset( p + i, ' ', n - i );
+}
+
+/** A string made by one of the above, and the same as a document. */
+typedef struct input {
+    const char *name;           /**< What kind of string it is */
+    char *s;                    /**< The string itself */
+    jvalue *j;                  /**< A document holding just it */
+} input;
+
+/** Make an input named \a name, filled in by \a fill. */
+static input
+mkinput( const char *name, void (*fill)( char *, size_t ))
+{
+    input in = (input){ .name = name, .s = emalloc( eb_size + 1 ) };
+    twine tw = (twine){ 0 };
+
+    (*fill)( in.s, eb_size );
+    in.s[ eb_size ] = 0;
+
+    twaddc( &tw, '"' );
+    for( const char *s = in.s; *s; ++s ) {
+        if( *s == '"' || *s == '\\' )
+            twaddc( &tw, '\\' );
+        twaddc( &tw, *s );
+    }
+    twaddc( &tw, '"' );
+    in.j = jparse_mem( tw.p, tw.len );
+    twclear( &tw );
+    if( !in.j )
+        die( 1, "cannot parse the %s input", name );
+    return in;
+}
+
+/** Find every byte in \a s that \a scan says needs escaping, the way
+ *  a writer would, and return how many there were. */
+static size_t
+scanall( size_t (*scan)( const char *, size_t ), const char *s, size_t n )
+{
+    size_t found = 0;
+
+    for( ;; ) {
+        size_t k = scan( s, n );
+        if( k == n )
+            return found;
+        ++found;
+        s += k + 1;
+        n -= k + 1;
+    }
+}
+
+/** Just like scanall(), but a byte at a time, as the writers used to. */
+static size_t
+byteall( bool (*special)( unsigned char ), const char *s, size_t n )
+{
+    size_t found = 0;
+
+    for( size_t i = 0; i < n; ++i )
+        found += (*special)( s[i] );
+    return found;
+}
+
+/** Returns true if \a c is an entity in XML. */
+static bool
+xmlspecial( unsigned char c )
+{
+    return c == '<' || c == '>' || c == '&' || c == '\'' || c == '"';
+}
+
+/** Returns true if \a c needs escaping in ksh. */
+static bool
+kshspecial( unsigned char c )
+{
+    return c < 0x20 || c >= 0x7f || c == '\'' || c == '\\';
+}
+
+/** Report the \a best time, in nanoseconds, that it took to do \a
+ *  what to the input \a in. */
+static void
+report( const char *in, const char *what, double best )
+{
+    printf( "%-8s %-12s %8.3f %10.1f\n", in, what, best / eb_size,
+            eb_size / best * 1e3 );
+}
+
+/** The ways we time each input. */
+enum ebways {
+    eb_bytexml,                 /**< XML classified a byte at a time */
+    eb_scanxml,                 /**< XML classified by scanxml() */
+    eb_writexml,                /**< The string written by writexml() */
+    eb_byteksh,                 /**< ksh classified a byte at a time */
+    eb_scanksh,                 /**< ksh classified by scanksh() */
+    eb_writeksh,                /**< The string written by writeksh() */
+    eb_ways
+};
+
+/** The names of each of ebways, in order. */
+static const char *ways[ eb_ways ] = {
+    "xml bytes", "xml scan", "writexml",
+    "ksh bytes", "ksh scan", "writeksh"
+};
+
+int
+main( void )
+{
+    input ins[] = {
+        mkinput( "ascii", ascii ),
+        mkinput( "entity", entity ),
+        mkinput( "utf8", utf8 )
+    };
+    obuf ob = (obuf){ .fd = -1 };
+    volatile size_t sink = 0;
+
+    scaninit();
+    printf( "%-8s %-12s %8s %10s\n", "input", "what", "ns/byte", "MB/s" );
+    for( size_t i = 0; i < sizeof( ins ) / sizeof( *ins ); ++i )
+        for( int w = 0; w < eb_ways; ++w ) {
+            double best = 0;
+
+            /* The first time through is just to warm up. */
+
+            for( int r = 0; r <= eb_reps; ++r ) {
+                double t = bmnow();
+                switch( w ) {
+                case eb_bytexml:
+                    sink += byteall( xmlspecial, ins[i].s, eb_size );
+                    break;
+                case eb_scanxml:
+                    sink += scanall( scanxml, ins[i].s, eb_size );
+                    break;
+                case eb_writexml:
+                    writexml( &ob, ins[i].j, jw_part );
+                    break;
+                case eb_byteksh:
+                    sink += byteall( kshspecial, ins[i].s, eb_size );
+                    break;
+                case eb_scanksh:
+                    sink += scanall( scanksh, ins[i].s, eb_size );
+                    break;
+                case eb_writeksh:
+                    writeksh( &ob, ins[i].j, 0 );
+                    break;
+                }
+                t = bmnow() - t;
+                ob.len = 0;
+                if( r && ( !best || t < best ))
+                    best = t;
+            }
+            report( ins[i].name, ways[w], best );
+        }
+
+    for( size_t i = 0; i < sizeof( ins ) / sizeof( *ins ); ++i ) {
+        free( ins[i].s );
+        jdel( ins[i].j );
+    }
+    obclear( &ob );
+    return 0;
+}
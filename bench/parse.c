@@ -0,0 +1,156 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "twine.h"
+#include "json.h"
+#include "bench.h"
+
+/* How much it costs to read strings and numbers, and then to parse a
+ * whole document into a tree. The readers of strings and numbers are
+ * private to the parser, so we time them through jevents_mem(), with
+ * a handler that does nothing, over arrays of nothing but the one
+ * kind of thing; what's left over is the little it costs to find the
+ * commas. The whole document is made of records such as a service
+ * might send, and is parsed with jparse_mem(), tree and all. */
+
+enum {
+    /** How many elements are in each array, and records in the
+     *  document. */
+    pb_size = 500 * 1000
+};
+
+/** Something to parse, and what to call it. */
+typedef struct input {
+    const char *name;           /**< What it's called in the report */
+    char *text;                 /**< The JSON */
+    size_t len;                 /**< How long it is */
+    size_t n;                   /**< How many things are in it */
+} input;
+
+/** What each run adds up, so that none of it is optimized away. */
+static volatile size_t sink;
+
+static bool
+nobegin( jhandler *h, enum jtypes t )
+{
+    (void)h, (void)t;
+    return true;
+}
+
+static bool
+nokey( jhandler *h, const char *n )
+{
+    (void)h, (void)n;
+    return true;
+}
+
+static bool
+noscalar( jhandler *h, enum jtypes t, const char *s, size_t n )
+{
+    (void)h, (void)t, (void)s;
+    sink += n;
+    return true;
+}
+
+/** A handler that throws away everything it's handed. */
+static jhandler nothing = {
+    .begin = nobegin, .key = nokey, .scalar = noscalar, .end = nobegin
+};
+
+/** Set \a in to the array made of #pb_size elements, each written by
+ *  \a fmt from its index, with \a name. */
+static void
+array( input *in, const char *name, const char *fmt )
+{
+    twine tw = (twine){ 0 };
+    char el[64];
+
+    twaddc( &tw, '[' );
+    for( long i = 0; i < pb_size; ++i ) {
+        if( i )
+            twaddc( &tw, ',' );
+        snprintf( el, sizeof( el ), fmt, i * 7919 % 1000003,
+                  i * 104729 % 100 );
+        twaddz( &tw, el );
+    }
+    twaddc( &tw, ']' );
+    *in = (input){ .name = name, .len = tw.len, .n = pb_size };
+    in->text = twfinal( &tw );
+}
+
+/** Set \a in to a document of #pb_size records. */
+static void
+records( input *in )
+{
+    twine tw = (twine){ 0 };
+    char rec[256];
+
+    twaddc( &tw, '[' );
+    for( long i = 0; i < pb_size; ++i ) {
+        snprintf( rec, sizeof( rec ),
+                  "%s{\"id\":%ld,\"name\":\"user %ld\",\"active\":%s,"
+                  "\"score\":%ld.%02ld,\"tags\":[\"a\",\"b\\tc\"],"
+                  "\"parent\":null}",
+                  i ? "," : "", i, i * 7919 % 1000003,
+                  i % 3 ? "true" : "false", i % 1000, i % 100 );
+        twaddz( &tw, rec );
+    }
+    twaddc( &tw, ']' );
+    *in = (input){ .name = "records", .len = tw.len, .n = pb_size };
+    in->text = twfinal( &tw );
+}
+
+/** Read \a arg, an input, with a handler that does nothing. */
+static void
+events( void *arg )
+{
+    const input *in = arg;
+
+    if( !jevents_mem( in->text, in->len, &nothing ))
+        die( 1, "cannot read %s", in->name );
+}
+
+/** Parse \a arg, an input, into a tree, and throw it away. */
+static void
+tree( void *arg )
+{
+    const input *in = arg;
+    jvalue *j = jparse_mem( in->text, in->len );
+
+    if( !j )
+        die( 1, "cannot parse %s", in->name );
+    jdel( j );
+}
+
+int
+main( void )
+{
+    input in[5];
+
+    array( &in[0], "plain", "\"member number %ld, %ld\"" );
+    array( &in[1], "escaped", "\"tab\\there, %ld\\n\\u00e9 %ld\"" );
+    array( &in[2], "ints", "%ld" );
+    array( &in[3], "reals", "-%ld.%02ld" );
+    records( &in[4] );
+
+    bmheading();
+    bmreport( in[0].name, "readstring", bmtime( events, &in[0] ),
+              in[0].n, in[0].len );
+    bmreport( in[1].name, "readstring", bmtime( events, &in[1] ),
+              in[1].n, in[1].len );
+    bmreport( in[2].name, "readnumber", bmtime( events, &in[2] ),
+              in[2].n, in[2].len );
+    bmreport( in[3].name, "readnumber", bmtime( events, &in[3] ),
+              in[3].n, in[3].len );
+    bmreport( in[4].name, "jparse", bmtime( tree, &in[4] ),
+              in[4].n, in[4].len );
+
+    for( int i = 0; i < 5; ++i )
+        free( in[i].text );
+    return 0;
+}
@@ -0,0 +1,135 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "twine.h"
+#include "json.h"
+#include "bench.h"
+
+/* How much it costs jupdate() to convert a big array of numbers, per
+ * element, first by itself, and then with jupdate_mt() and a few
+ * threads. Then, how much parsing the array and converting it costs
+ * altogether, first with jupdate() afterwards, and then with the
+ * parser doing it as it goes, under jp_numbers. Two arrays are tried:
+ * one of integers, and one of readings with a couple of decimal
+ * places, which become reals. */
+
+enum {
+    /** How many numbers are in each array. */
+    ub_size = 2 * 1000 * 1000,
+
+    /** How many times each is timed; we report the best. */
+    ub_reps = 5
+};
+
+/** Returns a JSON array of #ub_size integers, all different. */
+static char *
+integers( void )
+{
+    twine tw = (twine){ 0 };
+    char num[32];
+
+    twaddc( &tw, '[' );
+    for( long i = 0; i < ub_size; ++i ) {
+        snprintf( num, sizeof( num ), "%s%ld", i ? "," : "",
+                  i * 7919 % 100000007 - 50000000 );
+        twaddz( &tw, num );
+    }
+    twaddc( &tw, ']' );
+    return twfinal( &tw );
+}
+
+/** Returns a JSON array of #ub_size readings, all different. */
+static char *
+readings( void )
+{
+    twine tw = (twine){ 0 };
+    char num[32];
+
+    twaddc( &tw, '[' );
+    for( long i = 0; i < ub_size; ++i ) {
+        long v = i * 7919 % 1000003;
+        snprintf( num, sizeof( num ), "%s%ld.%02ld", i ? "," : "",
+                  v / 100 - 5000, v % 100 );
+        twaddz( &tw, num );
+    }
+    twaddc( &tw, ']' );
+    return twfinal( &tw );
+}
+
+/** Time converting the array \a text, named \a name, with \a threads
+ *  threads, or with jupdate() itself for zero. */
+static void
+timeit( const char *name, const char *text, unsigned threads )
+{
+    double best = 0;
+
+    for( int r = 0; r < ub_reps; ++r ) {
+        jvalue *j = jparse_mem( text, strlen( text ));
+        if( !j )
+            die( 1, "cannot parse the %s", name );
+
+        double t = bmnow();
+        if( threads )
+            jupdate_mt( j, threads );
+        else
+            jupdate( j );
+        t = bmnow() - t;
+        if( !best || t < best )
+            best = t;
+        jdel( j );
+    }
+
+    char how[32] = "jupdate";
+    if( threads )
+        snprintf( how, sizeof( how ), "jupdate_mt %u", threads );
+    printf( "%-10s %-14s %8.2f %10.1f\n", name, how, best / ub_size,
+            ub_size / best * 1e3 );
+}
+
+/** Time parsing the array \a text, named \a name, and converting its
+ *  numbers: with jupdate() afterwards when \a flags is zero, or by
+ *  the parser itself, according to \a flags. */
+static void
+timeparse( const char *name, const char *text, unsigned flags )
+{
+    double best = 0;
+
+    for( int r = 0; r < ub_reps; ++r ) {
+        double t = bmnow();
+        jvalue *j = flags ? jparsef_mem( text, strlen( text ), flags ) :
+            jupdate( jparse_mem( text, strlen( text )));
+        t = bmnow() - t;
+        if( !j )
+            die( 1, "cannot parse the %s", name );
+        if( !best || t < best )
+            best = t;
+        jdel( j );
+    }
+
+    printf( "%-10s %-14s %8.2f %10.1f\n", name,
+            flags ? "jp_numbers" : "parse+jupdate", best / ub_size,
+            ub_size / best * 1e3 );
+}
+
+int
+main( void )
+{
+    const char *names[] = { "integers", "readings" };
+    char *texts[] = { integers(), readings() };
+
+    printf( "%-10s %-14s %8s %10s\n", "array", "how", "ns/elt", "M/s" );
+    for( int i = 0; i < 2; ++i ) {
+        timeit( names[i], texts[i], 0 );
+        timeit( names[i], texts[i], 2 );
+        timeit( names[i], texts[i], 4 );
+        timeparse( names[i], texts[i], 0 );
+        timeparse( names[i], texts[i], jp_numbers );
+        free( texts[i] );
+    }
+    return 0;
+}
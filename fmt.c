@@ -0,0 +1,408 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "fmt.h"
+
+enum {
+    /** The highest power of ten that a long double holds exactly: 5^27
+     *  fits in the 64 bits of an x87 significand, 5^22 in the 53 of a
+     *  double, for where that's all a long double is. */
+    fm_exact = LDBL_MANT_DIG >= 64 ? 27 : 22,
+
+    /** How many significant digits it takes, at most, for any long
+     *  double to read back as itself. That's 21 for x87, 17 for a
+     *  double, and 36 for a quad. */
+    fm_digits = 2 + LDBL_MANT_DIG * 30103L / 100000,
+
+    /** Past this many digits before the decimal point, or this many
+     *  zeroes after it, fmtreal() uses an exponent. */
+    fm_plain_int = 21,
+    fm_plain_frac = 6
+};
+
+/** Every pair of decimal digits, in order, so that a number can be
+ *  written two digits for each division instead of one. */
+static const char pairs[] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+/** The powers of ten that a long double holds exactly, up to
+ *  #fm_exact. */
+static const long double p10[] = {
+    1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L,
+    1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+};
+
+/** Write the digits of \a u to \a buf, without a null, and return how
+ *  many there were. The digits are worked out backwards, into a
+ *  buffer just big enough for the biggest 64-bit number, and copied
+ *  to where they belong at the end. */
+static size_t
+utoa( char *buf, uint64_t u )
+{
+    char tmp[20], *q = tmp + sizeof( tmp );
+
+    while( u >= 100 ) {
+        q -= 2;
+        memcpy( q, pairs + 2 * ( u % 100 ), 2 );
+        u /= 100;
+    }
+    if( u >= 10 ) {
+        q -= 2;
+        memcpy( q, pairs + 2 * u, 2 );
+    } else
+        *--q = '0' + u;
+
+    size_t n = tmp + sizeof( tmp ) - q;
+    memcpy( buf, q, n );
+    return n;
+}
+
+/** Write the integer \a v to \a buf. */
+size_t
+fmtint( char *buf, long long v )
+{
+    size_t n = 0;
+
+    /* The negation is done unsigned, so that LLONG_MIN survives it. */
+
+    if( v < 0 )
+        buf[ n++ ] = '-';
+    n += utoa( buf + n, v < 0 ? -(unsigned long long)v : (uint64_t)v );
+    buf[n] = 0;
+    return n;
+}
+
+/** Find the digits of \a a, which is finite and positive, the quick
+ *  way: as an integer times a power of ten that a long double holds
+ *  exactly. Then the integer and the power are exact, and a single
+ *  rounding gets from them to the nearest long double, just as it
+ *  does when reading the number back. So, if that gets us \a a, we
+ *  have our digits. The smallest power that works leaves the fewest
+ *  of them, once any zeroes at the end are dropped. The digits go to
+ *  \a dig and their count is returned, with the power of ten they're
+ *  multiplied by in \a exp. Returns zero if there's no such integer
+ *  that fits in 64 bits, which is how the odd long double has to be
+ *  written. */
+static size_t
+quick( char *dig, int *exp, long double a )
+{
+    const long double two64 = 18446744073709551616.0L;
+    uint64_t m = 0;
+    int e = 0;
+
+    if( a < two64 ) {
+        for( ;; ) {
+            long double x = a * p10[-e];
+            if( x >= two64 )
+                return 0;
+            m = x < two64 / 2 ? (uint64_t)( x + 0.5L ) : (uint64_t)x;
+            if( m / p10[-e] == a )
+                break;
+            if( -e == fm_exact )
+                return 0;
+            --e;
+        }
+    } else {
+
+        /* Here, the first power that works can leave digits that a
+         * bigger one would round away, so we keep going until one
+         * doesn't work, and take the one before. If we run out of
+         * powers first, we can't know we've gone far enough. */
+
+        int f;
+        for( f = 1; a / p10[f] >= two64; ++f )
+            if( f == fm_exact )
+                return 0;
+        for( ; f <= fm_exact; ++f ) {
+            long double x = a / p10[f];
+            uint64_t mf = x < two64 / 2 ? (uint64_t)( x + 0.5L ) : (uint64_t)x;
+            if( mf * p10[f] != a )
+                break;
+            m = mf;
+            e = f;
+        }
+        if( !m || f > fm_exact )
+            return 0;
+    }
+
+    size_t n = utoa( dig, m );
+    while( n > 1 && dig[ n - 1 ] == '0' ) {
+        --n;
+        ++e;
+    }
+    *exp = e;
+    return n;
+}
+
+/** The slow way to do what quick() does, for the numbers it can't:
+ *  printf(3) with more and more digits, until they read back as \a
+ *  a. At #fm_digits, they always do. */
+static size_t
+slow( char *dig, int *exp, long double a )
+{
+    char tmp[ fmt_real_size ];
+    size_t n = 0;
+
+    for( int prec = 0; prec < fm_digits; ++prec ) {
+        snprintf( tmp, sizeof( tmp ), "%.*Le", prec, a );
+        if( strtold( tmp, 0 ) == a )
+            break;
+    }
+
+    /* What we have is d.ddde+xx, or de+xx. */
+
+    char *p = tmp;
+    dig[ n++ ] = *p++;
+    if( *p == '.' )
+        while( *++p != 'e' )
+            dig[ n++ ] = *p;
+    *exp = atoi( p + 1 ) - (int)( n - 1 );
+    while( n > 1 && dig[ n - 1 ] == '0' ) {
+        --n;
+        ++*exp;
+    }
+    return n;
+}
+
+/** Write the real \a v to \a buf, in as few digits as will read back
+ *  as \a v, exactly. */
+size_t
+fmtreal( char *buf, long double v )
+{
+    char dig[ fm_digits + 1 ];
+    size_t n = 0, nd;
+    int exp;
+
+    if( isnan( v )) {
+        memcpy( buf, "nan", 4 );
+        return 3;
+    }
+    if( signbit( v ))
+        buf[ n++ ] = '-';
+    if( isinf( v )) {
+        memcpy( buf + n, "inf", 4 );
+        return n + 3;
+    }
+    if( v == 0 ) {
+        memcpy( buf + n, "0", 2 );
+        return n + 1;
+    }
+
+    long double a = v < 0 ? -v : v;
+    nd = quick( dig, &exp, a );
+    if( !nd )
+        nd = slow( dig, &exp, a );
+
+    /* The number is the digits times ten to the exp; point is where
+     * the decimal point falls, counting from the first digit. */
+
+    int point = (int)nd + exp;
+    if( (int)nd <= point && point <= fm_plain_int ) {
+        memcpy( buf + n, dig, nd );
+        n += nd;
+        memset( buf + n, '0', point - nd );
+        n += point - nd;
+    } else if( 0 < point && point <= fm_plain_int ) {
+        memcpy( buf + n, dig, point );
+        n += point;
+        buf[ n++ ] = '.';
+        memcpy( buf + n, dig + point, nd - point );
+        n += nd - point;
+    } else if( -fm_plain_frac < point && point <= 0 ) {
+        buf[ n++ ] = '0';
+        buf[ n++ ] = '.';
+        memset( buf + n, '0', -point );
+        n += -point;
+        memcpy( buf + n, dig, nd );
+        n += nd;
+    } else {
+        buf[ n++ ] = dig[0];
+        if( nd > 1 ) {
+            buf[ n++ ] = '.';
+            memcpy( buf + n, dig + 1, nd - 1 );
+            n += nd - 1;
+        }
+        buf[ n++ ] = 'e';
+        buf[ n++ ] = point - 1 < 0 ? '-' : '+';
+        n += utoa( buf + n, point - 1 < 0 ? 1 - point : point - 1 );
+    }
+    buf[n] = 0;
+    return n;
+}
+
+/** Returns the eight bytes at \a p as a word, the first of them in the
+ *  low byte, whatever order the machine keeps its bytes in. Compilers
+ *  know this for a single load, where that's what it is. */
+static uint64_t
+load8( const char *p )
+{
+    const unsigned char *u = (const unsigned char *)p;
+
+    return (uint64_t)u[0] | (uint64_t)u[1] << 8 | (uint64_t)u[2] << 16 |
+        (uint64_t)u[3] << 24 | (uint64_t)u[4] << 32 | (uint64_t)u[5] << 40 |
+        (uint64_t)u[6] << 48 | (uint64_t)u[7] << 56;
+}
+
+/** Returns true if all of the bytes of \a w are decimal digits. Each
+ *  has to have 3 in its high nibble, and still have 3 there with 6
+ *  added to the low one; that is, the low one can't be past 9. */
+static bool
+alldigits( uint64_t w )
+{
+    return (( w & 0xf0f0f0f0f0f0f0f0 ) |
+            ((( w + 0x0606060606060606 ) & 0xf0f0f0f0f0f0f0f0 ) >> 4 )) ==
+        0x3333333333333333;
+}
+
+/** Returns the value of the eight decimal digits in \a w, as from
+ *  load8(). Adjacent digits are combined into pairs, pairs into
+ *  fours, and fours into eight, three multiplications in all. */
+static uint64_t
+value8( uint64_t w )
+{
+    const uint64_t mask = 0x000000ff000000ff;
+    const uint64_t mul1 = 100 + ( 1000000ULL << 32 );
+    const uint64_t mul2 = 1 + ( 10000ULL << 32 );
+
+    w -= 0x3030303030303030;
+    w = w * 10 + ( w >> 8 );
+    return (( w & mask ) * mul1 + (( w >> 16 ) & mask ) * mul2 ) >> 32 &
+        0xffffffff;
+}
+
+enum {
+    /** The most significant digits that always fit in 64 bits. */
+    fm_max_digits = 19
+};
+
+/** Add the digits from \a p up to \a end onto \a w, stopping at the
+ *  first thing that isn't one, and return where that is. The count of
+ *  significant digits in \a w is kept in \a nd; if it would go past
+ *  #fm_max_digits, we give up and return a null instead. */
+static const char *
+digits( const char *p, const char *end, uint64_t *w, int *nd )
+{
+    while( end - p >= 8 && *nd + 8 <= fm_max_digits ) {
+        uint64_t c = load8( p );
+        if( !alldigits( c ))
+            break;
+        *w = *w * 100000000 + value8( c );
+        *nd += *w ? 8 : 0;
+        p += 8;
+    }
+    for( ; p < end && *p >= '0' && *p <= '9'; ++p ) {
+        if( *nd == fm_max_digits )
+            return 0;
+        *w = *w * 10 + ( *p - '0' );
+        *nd += *w != 0;
+    }
+    return p;
+}
+
+/** Read the JSON number in the \a len bytes at \a s. If it's written
+ *  as an integer and fits in a long long, it goes to \a i and we
+ *  return true. Otherwise, it goes to \a r as a real, and we return
+ *  false. Nothing past the \a len bytes is ever looked at.
+ *
+ *  Up to #fm_max_digits significant digits make an integer that's
+ *  exact as a long double; so is a power of ten up to #fm_exact. So,
+ *  when that's all a real is, a single multiplication or division
+ *  rounds it just as strtold(3) would, only much faster. That takes
+ *  care of nearly everything. Anything else, and anything that isn't
+ *  quite what readnumber() would have let through, goes the slow
+ *  way, to strtoll(3) and strtold(3). An integer too big for a long
+ *  long is read as a real, rather than clamped. */
+bool
+fmtparse( const char *s, size_t len, long long *i, long double *r )
+{
+    const char *p = s, *end = s + len, *q;
+    uint64_t w = 0;
+    int nd = 0, e10 = 0;
+    bool neg = len && *p == '-';
+
+    p += neg;
+    if( !( q = digits( p, end, &w, &nd )) || q == p )
+        goto slow;
+    p = q;
+
+    if( p == end ) {
+        if( w <= (uint64_t)LLONG_MAX + neg ) {
+
+            /* Negating w - 1 keeps LLONG_MIN in range all the way. */
+
+            *i = neg && w ? -(long long)( w - 1 ) - 1 : (long long)w;
+            return true;
+        }
+        *r = neg ? -(long double)w : (long double)w;
+        return false;
+    }
+
+    if( *p == '.' ) {
+        if( !( q = digits( p + 1, end, &w, &nd )))
+            goto slow;
+        e10 -= q - ( p + 1 );
+        p = q;
+    }
+
+    /* An exponent with no digits, as in "1e", can get this far at
+     * the very end of the input; it's left to the C library. */
+
+    if( p < end && ( *p == 'e' || *p == 'E' )) {
+        if( ++p == end )
+            goto slow;
+        bool eneg = *p == '-';
+        int x = 0;
+        if( *p == '-' || *p == '+' )
+            ++p;
+        if( p == end || *p < '0' || *p > '9' )
+            goto slow;
+        for( ; p < end && *p >= '0' && *p <= '9'; ++p )
+            if(( x = x * 10 + ( *p - '0' )) > 9999 )
+                goto slow;
+        e10 += eneg ? -x : x;
+    }
+
+    if( p != end || e10 < -fm_exact || e10 > fm_exact ||
+        ( LDBL_MANT_DIG < 64 && w >> 53 ))
+        goto slow;
+
+    long double v = e10 < 0 ? w / p10[-e10] : w * p10[e10];
+    *r = neg ? -v : v;
+    return false;
+
+slow:
+
+    /* The C library wants a null at the end, so we make a copy. Only
+     * a number of absurd length needs one from the heap. */
+
+    char tmp[64], *c = len < sizeof( tmp ) ? tmp : emalloc( len + 1 );
+    bool isint = false;
+
+    memcpy( c, s, len );
+    c[ len ] = 0;
+    if( !strpbrk( c, ".eE" )) {
+        errno = 0;
+        *i = strtoll( c, 0, 10 );
+        isint = errno != ERANGE;
+    }
+    if( !isint )
+        *r = strtold( c, 0 );
+    if( c != tmp )
+        free( c );
+    return isint;
+}
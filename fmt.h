@@ -0,0 +1,41 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_fmt_h
+#define jsoncvt_fmt_h
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Numbers, formatted for output without printf(3), and read back in
+ *  without strtoll(3) and strtold(3). The writers put out every number
+ *  in a document that jupdate() has converted, and printf charges for
+ *  each one: a format string to parse, a locale to consult, and, for
+ *  %Lg, only six significant digits to show for it.
+ *
+ *  fmtint() writes an integer two digits at a time, from a table of
+ *  every pair of digits. fmtreal() writes the shortest decimal that
+ *  reads back as exactly the same long double, in the style of
+ *  JavaScript: plain digits for anything from 1e-6 up to 1e21, and an
+ *  exponent otherwise. Both write into a buffer of the caller's,
+ *  which must be at least #fmt_int_size or #fmt_real_size bytes, add
+ *  a null, and return how many bytes they wrote before it.
+ *
+ *  fmtparse() goes the other way, for jupdate() and the parser, turning
+ *  the text of a JSON number into an integer if it's written as one
+ *  and fits, or a real otherwise. The text needn't end in a null.
+ *  Integers are read eight digits at a time, and most reals are a
+ *  single multiplication or division away from their digits; only the
+ *  odd number goes to the C library. */
+
+enum {
+    /** Room enough for anything from fmtint(), null and all. */
+    fmt_int_size = 24,
+
+    /** Room enough for anything from fmtreal(), null and all. */
+    fmt_real_size = 64
+};
+
+extern size_t fmtint( char *, long long );
+extern size_t fmtreal( char *, long double );
+extern bool fmtparse( const char *, size_t, long long *, long double * );
+
+#endif
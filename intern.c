@@ -0,0 +1,120 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "arena.h"
+#include "intern.h"
+
+enum {
+    /** The number of slots in a table when the first string arrives.
+     *  Always a power of two; most documents have only a few dozen
+     *  distinct member names, so this rarely needs to grow at all. */
+    in_initial_size = 64
+};
+
+/** One slot in the hash table. We keep the hash and length of each
+ *  string right alongside the pointer, so that a probe can rule out
+ *  almost every mismatch without touching the string itself. An
+ *  empty slot has a null #s. */
+typedef struct inslot {
+    const char *s;              /**< Our copy of the string */
+    size_t len;                 /**< Its length, not counting the null */
+    uint32_t h;                 /**< Its hash, from inhash() */
+} inslot;
+
+/** The FNV-1a hash of the \a n bytes at \a s. Member names are short,
+ *  so something this simple does as well as anything fancier. */
+static uint32_t
+inhash( const char *s, size_t n )
+{
+    uint32_t h = 2166136261u;
+
+    while( n-- ) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/** Allocate a new empty intern table from the heap and return a
+ *  pointer to it. */
+intab *
+innew()
+{
+    intab *t = emalloc( sizeof( *t ));
+    *t = (intab){ 0 };
+    return t;
+}
+
+/** Release every string interned in \a t, along with the table
+ *  itself, leaving \a t empty but valid. Any pointer obtained from
+ *  inadd() is no longer valid once this is called. */
+intab *
+inclear( intab *t )
+{
+    if( !t )
+        return 0;
+    free( t->slot );
+    arclear( &t->a );
+    *t = (intab){ 0 };
+    return t;
+}
+
+/** Release an intern table obtained via innew(), and every string in
+ *  it. Once called, \a t is <em>no longer valid.</em> */
+void
+indel( intab *t )
+{
+    free( inclear( t ));
+}
+
+/** Double the number of slots in \a t, moving everything over. The
+ *  strings themselves stay right where they are. */
+static void
+ingrow( intab *t )
+{
+    size_t sz = t->sz ? t->sz * 2 : in_initial_size;
+    inslot *slot = emalloc( sz * sizeof( *slot ));
+
+    memset( slot, 0, sz * sizeof( *slot ));
+    for( size_t i = 0; i < t->sz; ++i )
+        if( t->slot[i].s ) {
+            size_t k = t->slot[i].h & ( sz - 1 );
+            while( slot[k].s )
+                k = ( k + 1 ) & ( sz - 1 );
+            slot[k] = t->slot[i];
+        }
+
+    free( t->slot );
+    t->slot = slot;
+    t->sz = sz;
+}
+
+/** Return the table's copy of the \a n bytes at \a s, which needn't
+ *  be null terminated, making one if this is the first time we've seen
+ *  them. The copy is null terminated, aligned to #in_align bytes, and
+ *  must never be modified. */
+const char *
+inadd( intab *t, const char *s, size_t n )
+{
+    if( 2 * ( t->len + 1 ) > t->sz )
+        ingrow( t );
+
+    uint32_t h = inhash( s, n );
+    size_t k = h & ( t->sz - 1 );
+
+    for( ; t->slot[k].s; k = ( k + 1 ) & ( t->sz - 1 ))
+        if( t->slot[k].h == h && t->slot[k].len == n
+            && !memcmp( t->slot[k].s, s, n ))
+            return t->slot[k].s;
+
+    ++t->len;
+    char *p = armemalign( &t->a, in_align, n + 1 );
+    memcpy( p, s, n );
+    p[n] = 0;
+    t->slot[k] = (inslot){ .s = p, .len = n, .h = h };
+    return p;
+}
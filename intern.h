@@ -0,0 +1,49 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_intern_h
+#define jsoncvt_intern_h
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+enum {
+    /** Every copy made by inadd() begins on a multiple of this many
+     *  bytes. */
+    in_align = 16
+};
+
+/** An intern table keeps exactly one copy of every string it has ever
+ *  been shown. Hand it the bytes of a string, and it returns its copy
+ *  of those bytes, making one the first time they turn up. Two
+ *  strings interned in the same table are therefore equal if and only
+ *  if their pointers are, and the thousands of objects in an array of
+ *  records all share a single copy of each member name.
+ *
+ *  The copies are immutable, and live in the table's own arena until
+ *  the table itself is cleared. Each is aligned to #in_align bytes,
+ *  so the low bits of its address are always zero; a caller is free
+ *  to borrow them for something else of its own.
+ *
+ *  Expected usage is something like
+ *
+ *  1. Obtain a new table via innew(), or initialize one to all zeroes.
+ *
+ *  2. Use inadd() to find (or make) the copy of a string.
+ *
+ *  3. Release every copy and the table's storage via inclear(),
+ *  leaving the table empty but still valid.
+ *
+ *  4. if you called innew() earlier, call indel() to free it. */
+typedef struct intab {
+    struct inslot *slot;        /**< Open addressed hash table */
+    size_t len;                 /**< How many slots are in use */
+    size_t sz;                  /**< How many slots there are */
+    arena a;                    /**< Where the copies live */
+} intab;
+
+extern intab *innew();
+extern intab *inclear( intab * );
+extern void indel( intab * );
+extern const char *inadd( intab *, const char *, size_t );
+
+#endif
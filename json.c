@@ -1,150 +1,416 @@
 /* See one of the index files for license and other details. */
 #define _POSIX_C_SOURCE 200112L
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 #include "sanity.h"
+#include "arena.h"
+#include "intern.h"
+#include "scan.h"
 #include "twine.h"
 #include "ptrvec.h"
+#include "fmt.h"
 #include "json.h"
 
-/** This just makes it easier for us to track a line counter along
- *  with an input stream, so when we report errors, we can say
- *  something useful about where the error appeared. getch() will bump
- *  #line when a newline appears on the file stream. Initialize this
- *  with a file stream opened for reading, and set #line to 1. */
+enum {
+    /** The size of the blocks we pull from the input descriptor with
+     *  each read(2). Big enough that the system call overhead
+     *  vanishes into the noise, small enough to stay friendly with
+     *  the caches. */
+    if_blksize = 128 * 1024
+};
+
+/** A buffered reader over the JSON input. Rather than going through
+ *  stdio for every byte (which, in a reentrant build, means taking a
+ *  lock on the stream every single time), we pull large blocks
+ *  straight off the descriptor with read(2) and let the parser peek
+ *  and advance through them directly. Initialize this with an open
+ *  descriptor in #fd, a line of 1, and zeroes everywhere else.
+ *
+ *  When the entire document is already in memory, there's no need
+ *  for any of that; point #p and #len at it, set #eof, and the
+ *  parser runs straight over the caller's bytes.
+ *
+ *  A scanner runs over the input ahead of the parser (see scan.h),
+ *  marking where each token begins, one window at a time. Whenever
+ *  the parser finds itself looking at whitespace, it uses those marks
+ *  to jump straight to the next token.
+ *
+ *  Strings and numbers are gathered up in #tw when they can't be
+ *  handed over straight from the input. Member names go into the
+ *  intern table at #names, so that each distinct name is only kept
+ *  once.
+ *
+ *  We don't track line numbers as we go; that would mean testing
+ *  every byte for a newline on the hot path. Instead, #line only
+ *  accounts for the blocks we've already thrown away, and lineno()
+ *  counts up the rest on the rare occasion that we need to report
+ *  an error. */
 typedef struct ifile {
-    FILE *fp;                   /**< Input file stream */
-    size_t line;                /**< Line number */
+    int fd;                     /**< Input descriptor */
+    const char *p;              /**< Buffered input */
+    size_t len;                 /**< Number of bytes buffered at #p */
+    size_t pos;                 /**< Offset of the next byte at #p */
+    size_t line;                /**< Line number at the start of #p */
+    char *buf;                  /**< Our block buffer, when reading #fd */
+    bool eof;                   /**< No more input beyond #len */
+    scanner sc;                 /**< Finds the tokens at #p */
+    uint64_t *bits;             /**< Token bits from #sc, from #ib */
+    size_t ib;                  /**< Offset of the first byte in #bits */
+    size_t ie;                  /**< Offset just past the last byte in #bits */
+    intab *names;               /**< Where member names are interned */
+    twine tw;                   /**< Scratch space for strings and numbers */
+    twine open;                 /**< The containers open; see readvalue() */
+    size_t maxdepth;            /**< How deep they may go, or zero */
+    const char *path;           /**< Only read what's here; see project() */
 } ifile;
 
-static jvalue *readvalue( ifile * );
+/** Every tree we hand out is a document: the root of the tree, plus
+ *  the arena that everything beneath it was allocated from, and the
+ *  table its member names were interned in. The root comes first, so
+ *  a pointer to the root is a pointer to the whole document. */
+typedef struct jdoc {
+    jvalue root;                /**< The top of the tree */
+    arena a;                    /**< Where the rest of the tree lives */
+    intab names;                /**< One copy of each member name */
+} jdoc;
+
+/** Count the newlines in the first \a n bytes at \a p. */
+static size_t
+countnl( const char *p, size_t n )
+{
+    size_t nl = 0;
+    const char *end = p + n;
 
-/* When we're running single threaded, use the faster getc_unlocked(3)
- * that doesn't enforce thread safety; otherwise, use the regular
- * getc(3) which works everywhere. This is a bit of overkill, since
- * once a file stream is passed to the JSON parser, _even if_ we were
- * multithreaded, this is the only code that should be reading from
- * the stream. But, still, let's try to play by the rules. */
-inline static int
-jgetc( FILE *f )
+    while(( p = memchr( p, '\n', end - p ))) {
+        ++nl;
+        ++p;
+    }
+    return nl;
+}
+
+/** Returns the line number of the byte most recently read from \a f;
+ *  that is, the one just before #pos. */
+static size_t
+lineno( const ifile *f )
+{
+    return f->line + countnl( f->p, f->pos );
+}
+
+/** Returns the index of the lowest bit set in \a m, which must not be
+ *  zero. */
+inline static unsigned
+lowbit( uint64_t m )
 {
-#ifdef _REENTRANT
-    return getc( f );
+#ifdef __GNUC__
+    return __builtin_ctzll( m );
 #else
-    return getc_unlocked( f );
+    unsigned n = 0;
+    while( !( m & 1 )) {
+        m >>= 1;
+        ++n;
+    }
+    return n;
 #endif
 }
 
-/** Returns the next character in the open input stream under \a f,
- *  and bump the line counter in \a f when appropriate. Errors can
- *  always be reported using line. */
-static int
+/** Run the scanner over the next window of input at \a f that it
+ *  hasn't seen yet. The scanner only works on whole 64 byte blocks, so
+ *  a partial block at the end of the buffer has to wait for more
+ *  input, unless there isn't going to be any, in which case we pad
+ *  it out with whitespace. Returns false if nothing could be
+ *  scanned. */
+static bool
+scanmore( ifile *f )
+{
+    if( f->ie >= f->len )
+        return false;
+    if( !f->bits )
+        f->bits = emalloc( if_blksize / 64 * sizeof( *f->bits ));
+
+    size_t n = f->len - f->ie;
+    if( n > if_blksize )
+        n = if_blksize;
+    n &= ~(size_t)63;
+
+    f->ib = f->ie;
+    if( n ) {
+        scanidx( &f->sc, f->p + f->ib, n, f->bits );
+        f->ie += n;
+    } else if( f->eof ) {
+        char pad[ 64 ];
+        memset( pad, ' ', sizeof( pad ));
+        memcpy( pad, f->p + f->ib, f->len - f->ib );
+        scanidx( &f->sc, pad, sizeof( pad ), f->bits );
+        f->ie += sizeof( pad );
+    } else
+        return false;
+    return true;
+}
+
+/** Returns the offset of the first token at or after \a i, using the
+ *  bits found by scanmore(), or the end of the window if there are
+ *  none left in it. */
+static size_t
+nexttok( const ifile *f, size_t i )
+{
+    size_t end = f->ie < f->len ? f->ie : f->len;
+    if( i >= end )
+        return end;
+
+    size_t w = ( i - f->ib ) / 64;
+    size_t nw = ( f->ie - f->ib ) / 64;
+    uint64_t m = f->bits[ w ] & ( ~(uint64_t)0 << ( i - f->ib ) % 64 );
+
+    while( !m )
+        if( ++w == nw )
+            return end;
+        else
+            m = f->bits[ w ];
+    return f->ib + w * 64 + lowbit( m );
+}
+
+/** Throw away everything in the buffer at \a f that has already been
+ *  read, and pull in the next block of input. Returns false once the
+ *  input is exhausted (or unreadable). Since the scanner has to see
+ *  every byte exactly once, we let it catch up first; only the partial
+ *  block it couldn't finish is kept around. */
+static bool
+fill( ifile *f )
+{
+    if( f->eof )
+        return false;
+    if( !f->buf )
+        f->p = f->buf = emalloc( if_blksize );
+
+    while( scanmore( f ))
+        ;
+    f->line += countnl( f->p, f->ie );
+    f->len -= f->ie;
+    f->pos -= f->ie;
+    memmove( f->buf, f->p + f->ie, f->len );
+    f->ib = f->ie = 0;
+
+    ssize_t n;
+    do
+        n = read( f->fd, f->buf + f->len, if_blksize - f->len );
+    while( n < 0 && errno == EINTR );
+
+    if( n < 0 )
+        err( "cannot read JSON data: %s", strerror( errno ));
+    if( n <= 0 ) {
+        f->eof = true;
+        return false;
+    }
+
+    f->len += n;
+    return true;
+}
+
+/** Returns the next byte in the input under \a f without consuming
+ *  it, or EOF when there are no more. */
+inline static int
+peekch( ifile *f )
+{
+    if( f->pos < f->len || fill( f ))
+        return (unsigned char)f->p[ f->pos ];
+    return EOF;
+}
+
+/** Returns the next byte in the input under \a f, consuming it, or
+ *  EOF when there are no more. */
+inline static int
 getch( ifile *f )
 {
-    int c = jgetc( f->fp );
-    if( c == '\n' )
-        ++f->line;
-    return c;
+    if( f->pos < f->len || fill( f ))
+        return (unsigned char)f->p[ f->pos++ ];
+    return EOF;
 }
 
-/** Return a character back to the file stream under \a f, like
- *  ungetc() would, but also manage its line counter. Though many
- *  stdio's can handle it, there is actually no guarantee that more
- *  than a single character can ever be pushed back onto the file
- *  stream. */
-static int
-ungetch( ifile *f, char c )
+/** Step back over the byte most recently obtained from getch(). Just
+ *  like ungetc(3), only one byte can ever be pushed back this way,
+ *  but since the byte is still sitting in our buffer, there's no need
+ *  to say which one it was. */
+inline static void
+ungetch( ifile *f )
 {
-    if( c == '\n' )
-        --f->line;
-    return ungetc( c, f->fp );
+    --f->pos;
 }
 
-/** A wrapper around getch() that skips any leading whitespace before
- *  the character eventually returned, or EOF. Rather than a
+/** Skip ahead over any leading whitespace, leaving the next
+ *  non-whitespace character in the buffer ready for reading. The
+ *  character returned is effectively a "peek" ahead at the next
+ *  character that will be obtained from getch(). Rather than a
  *  traditional parsing of whitespace, we limit ourselves to only the
  *  ws characters defined in JSON. */
 static int
-getchskip( ifile *f )
+skipws( ifile *f )
 {
-    int c;
     do {
-        c = getch( f );
-    } while( c == ' ' || c == '\t' || c == '\n' || c == '\r' );
-    return c;
+        while( f->pos < f->len ) {
+            char c = f->p[ f->pos ];
+            if( c != ' ' && c != '\t' && c != '\n' && c != '\r' )
+                return (unsigned char)c;
+            if( f->pos < f->ie )
+                f->pos = nexttok( f, f->pos + 1 );
+            else if( !scanmore( f ))
+                ++f->pos;
+        }
+    } while( fill( f ));
+    return EOF;
 }
 
-/** Skip ahead over any leading whitespace, leaving the next
- *  non-whitespace character in the stream ready for reading. The
- *  character returned is effectively a "peek" ahead at the next
- *  character that will be obtained from getch(). */
+/** Move \a f along to the first token after the byte at #pos, the
+ *  way skipws() does, scanning and reading more input as it takes,
+ *  and return the byte there; or EOF, once the input runs out. Since
+ *  the scanner already knows where every string begins and ends, the
+ *  bytes in between are never so much as looked at. Once the input
+ *  has run out, the last partial block can be scanned after all, so
+ *  we go around once more for that. */
 static int
-skipws( ifile *f )
+nexttoken( ifile *f )
+{
+    ++f->pos;
+    do {
+        while( f->pos < f->len )
+            if( f->pos < f->ie ) {
+                f->pos = nexttok( f, f->pos );
+                if( f->pos < f->ie && f->pos < f->len )
+                    return (unsigned char)f->p[ f->pos ];
+            } else if( !scanmore( f ))
+                break;
+    } while( fill( f ) || f->pos < f->len );
+    return EOF;
+}
+
+/** Like skipws(), but the character found is consumed as well. */
+static int
+getchskip( ifile *f )
 {
-    int c = getchskip( f );
+    int c = skipws( f );
     if( c != EOF )
-        ungetch( f, c );
+        ++f->pos;
     return c;
 }
 
-/** Create and return a new jvalue, initialized to be a jnull. Does
- *  not return if a new jvalue could not be allocated. */
+/** Create and return a new document, whose root jvalue is returned,
+ *  initialized to be a jnull. Does not return if a new jvalue could
+ *  not be allocated. */
 jvalue *
 jnew()
 {
-    jvalue *j = emalloc( sizeof( *j ));
-    *j = (jvalue){ 0 };
-    j->d = jnull;
-    return j;
+    jdoc *d = emalloc( sizeof( *d ));
+    *d = (jdoc){ 0 };
+    d->root.nt = jnull;
+    return &d->root;
 }
 
-/** Walk a tree of jvalue, or even just a single jvalue, and free
- *  everything it contains, leaving \j intact but set to jnull.
- *  Normally, we'd set the various freed pointers to null explicitly,
- *  but at the end of the function, we zero the entire structure. */
+/** Reset a jvalue, or even an entire tree of them, leaving \a j
+ *  intact but set to jnull. Nothing is freed here; everything in a
+ *  tree belongs to its document, and all of it goes away at once when
+ *  the root of that document is handed to jdel(). That goes double
+ *  for its name, which is likely shared with any number of other
+ *  values. */
 jvalue *
 jclear( jvalue *j )
 {
     if( j ) {
-        free( j->n );
-
-        switch( j->d ) {
-        case jarray:
-        case jobject:
-            if( j->u.v )
-                for( jvalue **jv = j->u.v; *jv; ++jv )
-                    jdel( *jv );
-            free( j->u.v );
-            break;
+        *j = (jvalue){ 0 };
+        j->nt = jnull;
+    }
 
-        case jstring:
-        case jnumber:
-            free( j->u.s );
-            break;
+    return j;
+}
 
-        default:
-            break;
-        }
+/** Returns what the value \a j adds to the census of the container
+ *  it's in; see jcensus(). */
+static unsigned
+census( const jvalue *j )
+{
+    enum jtypes t = jtype( j );
 
-        *j = (jvalue){ 0 };
-        j->d = jnull;
-    }
+    if( t == jnumber && strchr( j->u.s, '.' ))
+        return 1u << t | jc_frac;
+    return 1u << t;
+}
+
+/** Replace the census of the container \a j with \a c. */
+static void
+setcensus( jvalue *j, unsigned c )
+{
+    ( (uintptr_t *)j->u.v )[-1] = c;
+}
+
+/** Give the container \a j a vector of its own in the arena \a a,
+ *  holding the \a n elements at \a p, with a census of \a c. */
+static void
+setvec( arena *a, jvalue *j, jvalue *const *p, size_t n, unsigned c )
+{
+    uintptr_t *w = aralloc( a, sizeof( *w ) + ( n + 1 ) * sizeof( *p ));
+    jvalue **v = (jvalue **)( w + 1 );
+
+    if( n )
+        memcpy( v, p, n * sizeof( *v ));
+    v[n] = 0;
+    *w = c;
+    j->u.v = v;
+}
+
+/** Give \a j, a jarray or jobject somewhere in the document whose root
+ *  is \a root, the \a n elements at \a p as its own. They're copied
+ *  into a vector in the document, taking a census of them on the way,
+ *  so the caller is free to do as they like with \a p afterwards. Like
+ *  jsetname(), this is the only proper way to do it. Returns \a j. */
+jvalue *
+jsetvec( jvalue *root, jvalue *j, jvalue *const *p, size_t n )
+{
+    unsigned c = 0;
+
+    for( size_t i = 0; i < n; ++i )
+        c |= census( p[i] );
+    setvec( &( (jdoc *)root )->a, j, p, n, c );
+    return j;
+}
+
+/** Give \a j, somewhere in the document whose root is \a root, the
+ *  name \a n; a null \a n takes its name away. The name is interned
+ *  in the document, so the caller is free to do as they like with \a
+ *  n afterwards. This is the only proper way to name a value, since
+ *  the name has to be suitably aligned to share a word with the type
+ *  of \a j. Returns \a j. */
+jvalue *
+jsetname( jvalue *root, jvalue *j, const char *n )
+{
+    const char *in = n ? inadd( &( (jdoc *)root )->names, n, strlen( n )) : 0;
 
+    j->nt = (uintptr_t)in | jtype( j );
     return j;
 }
 
-/** Walk a tree of jvalue, or even just a single value, and free
- *  everything it contains. Everything, even \a j itself, is freed.
- *  When this is complete, \a j is <em>no longer valid.</em> */
+/** Free an entire document, given its root \a j (as returned by
+ *  jnew() or jparse()). Every jvalue in the tree, every string and
+ *  every vector, and every interned name goes in one fell swoop,
+ *  without walking the tree.
+ *  When this is complete, \a j and everything under it are <em>no
+ *  longer valid.</em> Only the root of a document may be passed
+ *  here. */
 void
 jdel( jvalue *j )
 {
-    free( jclear( j ));
+    if( j ) {
+        jdoc *d = (jdoc *)j;
+        arclear( &d->a );
+        inclear( &d->names );
+        free( d );
+    }
 }
 
 /** Report an early EOF; that is, that the input stream ended before a
@@ -179,7 +445,7 @@ ierr( const ifile *f, const char *msg, ... )
     va_start( ap, msg );
     vsnprintf( buf, sizeof( buf ), msg, ap );
     va_end( ap );
-    err( "%s on line %zu in JSON data", buf, f->line );
+    err( "%s on line %zu in JSON data", buf, lineno( f ));
 }
 
 /** The next character read from \a f must be a double quote. */
@@ -198,161 +464,232 @@ expectdq( ifile *f )
         return true;
 }
 
+/** We just read a backslash inside a string from \a f; read the rest
+ *  of the escape that it introduces, and add whatever it stands for
+ *  to \a tw. Returns false (after a diagnostic) on a bad escape. */
+static bool
+readescape( ifile *f, twine *tw )
+{
+    int c = getch( f );
+
+    switch( c ) {
+    case EOF:  earlyeof(); return false;
+    case '"':  twaddc( tw, '"' ); return true;
+    case '/':  twaddc( tw, '/' ); return true;
+    case '\\': twaddc( tw, '\\' ); return true;
+    case 'b':  twaddc( tw, '\b' ); return true;
+    case 'f':  twaddc( tw, '\f' ); return true;
+    case 'n':  twaddc( tw, '\n' ); return true;
+    case 'r':  twaddc( tw, '\r' ); return true;
+    case 't':  twaddc( tw, '\t' ); return true;
+    case 'u':
+        break;
+    default:
+        ierr( f, "unknown escape code '\\%c'", (char)c );
+        return false;
+    }
+
+    /* Read four hex digits as a Unicode code point. */
+    unsigned int x = 0;
+    for( int hex = 4; hex; --hex )
+        if(( c = getch( f )) == EOF ) {
+            earlyeof();
+            return false;
+        } else if( !isxdigit( c )) {
+            ierr( f, "expected hex digit" );
+            return false;
+        } else if( isdigit( c ))
+            x = 16 * x + c - '0';
+        else if( isupper( c ))
+            x = 16 * x + c - 'A' + 10;
+        else
+            x = 16 * x + c - 'a' + 10;
+    twaddu( tw, x );
+    return true;
+}
+
 /** Reads a JSON string that is wrapped with quotes from \a f, parsing
- *  all the various string escapes therein. Returns a C string (sans
- *  quotes) freshly allocated from the heap, or a null on error. When
- *  null is returned, a diagnostic will have been sent to the standard
- *  error stream. */
-static char *
-readstring( ifile *f )
+ *  all the various string escapes therein. Returns the bytes of the
+ *  string (sans quotes), storing their count at \a n, or a null on
+ *  error. When null is returned, a diagnostic will have been sent to
+ *  the standard error stream. The bytes returned are only good until
+ *  the next read from \a f; see readname() for something more
+ *  permanent.
+ *
+ *  Most strings are long runs of plain bytes with hardly an escape in
+ *  sight, so rather than handle a byte at a time, we let scanstr()
+ *  find the end of each run and copy the whole thing at once. When
+ *  the closing quote turns up before anything else, the string is
+ *  sitting right there in the input, and needn't be copied at all. */
+static const char *
+readstr( ifile *f, size_t *n )
 {
     if( !expectdq( f ))
         return 0;
 
-    bool esc = false;           /* the next character is escaped */
-    bool oops = false;          /* a bad string was seen? */
-    unsigned int hex = 0;       /* read this many chars as a hex
-                                 * Unicode code point */
-    unsigned int x = 0;
-    twine tw = (twine){ 0 };
+    f->tw.len = 0;
+
+    for( ;; ) {
+        const char *run = f->p + f->pos;
+        size_t avail = f->len - f->pos;
+        size_t k = scanstr( run, avail );
+
+        f->pos += k;
+        if( k < avail && run[k] == '"' && !f->tw.len ) {
+            ++f->pos;
+            *n = k;
+            return run;
+        }
+        if( k )
+            twaddn( &f->tw, run, k );
 
-    while( !oops ) {
         int c = getch( f );
 
         if( c == EOF ) {
             earlyeof();
-            oops = true;
-
-        } else if( hex ) {
-            if( isxdigit( c )) {
-	        if( isdigit( c ))
-		    x = 16 * x + c - '0';
-		else if( isupper( c ))
-		    x = 16 * x + c - 'A' + 10;
-		else
-		    x = 16 * x + c - 'a' + 10;
-                if( !--hex )
-                    twaddu( &tw, x );
-            } else {
-                ierr( f, "expected hex digit" );
-                oops = true;
-            }
-
-        } else if( esc ) {
-            switch( c ) {
-            case '"':  twaddc( &tw, '"' ); break;
-            case '/':  twaddc( &tw, '/' ); break;
-            case '\\': twaddc( &tw, '\\' ); break;
-            case 'b':  twaddc( &tw, '\b' ); break;
-            case 'f':  twaddc( &tw, '\f' ); break;
-            case 'n':  twaddc( &tw, '\n' ); break;
-            case 'r':  twaddc( &tw, '\r' ); break;
-            case 't':  twaddc( &tw, '\t' ); break;
-            case 'u':
-                x = 0;
-                hex = 4;
+            break;
+        } else if( c == '"' ) { /* done parsing the string! bye! */
+            *n = f->tw.len;
+            return f->tw.p ? f->tw.p : "";
+        } else if( c == '\\' ) {
+            if( !readescape( f, &f->tw ))
                 break;
-            default:
-                ierr( f, "unknown escape code '\\%c'", (char)c );
-                oops = true;
-            }
-            esc = 0;
-        
-        } else if( c == '"' )    /* done parsing the string! bye! */
-            return twfinal( &tw );
-
-        else if( c == '\\' )
-            esc = 1;
-
-        else if( c >= ' ' )
-            twaddc( &tw, c );
-
+        } else if( c >= ' ' )
+            twaddc( &f->tw, c );
         else if( isspace( c )) {
             ierr( f, "unescaped whitespace" );
-            oops = true;
-
+            break;
         } else {
             ierr( f, "unknown byte (0x%02x)", c );
-            oops = true;
+            break;
         }
     }
 
-    twclear( &tw );             /* oops. bad string. give up and go
+    return 0;                   /* oops. bad string. give up and go
                                  * home. */
-    return 0;
 }
 
-/** Used by readnumber(), this is passed the twine under construction
- *  and returns the value we should return to the readnumber() caller.
- *  It ensures that any storage accumulated in supplied twine is
- *  returned to the system, and returns 0, which readnumber() should
- *  chain return back to its caller, indicating a failure. Because
- *  this is only used by readnumber(), we'll mark it static. */
-static char *
-readnumberfail( twine *tw )
+/** Reads the name of an object member from \a f, just like
+ *  readstr(), except that the C string returned is the copy kept in
+ *  the intern table. An array of a million records has only as many
+ *  names as each record does, rather than a million copies of each. */
+static const char *
+readname( ifile *f )
 {
-    twclear( tw );
-    return 0;
+    size_t n;
+    const char *s = readstr( f, &n );
+
+    return s ? inadd( f->names, s, n ) : 0;
+}
+
+/** Returns the length of the JSON number at the start of the bytes
+ *  from \a p up to \a end, following the same rules as readnumber(),
+ *  or zero if there isn't one. */
+static size_t
+numspan( const char *p, const char *end )
+{
+    const char *s = p;
+
+    if( p < end && *p == '-' )
+        ++p;
+    if( p < end && *p == '0' )
+        ++p;
+    else if( p < end && *p >= '1' && *p <= '9' )
+        while( ++p < end && *p >= '0' && *p <= '9' )
+            ;
+    else
+        return 0;
+
+    if( p < end && *p == '.' )
+        while( ++p < end && *p >= '0' && *p <= '9' )
+            ;
+    if( p < end && ( *p == 'e' || *p == 'E' )) {
+        if( ++p < end && ( *p == '+' || *p == '-' ))
+            ++p;
+        while( p < end && *p >= '0' && *p <= '9' )
+            ++p;
+    }
+    return p - s;
 }
 
 /** We just peeked ahead and saw something that introduces a number.
- *  Gather it up into a string. The client can opt to convert this
- *  into a real number (integer or real) via jupdate() if they choose.
+ *  Gather it up into a string, returning its bytes and storing their
+ *  count at \a n, just like readstr(). The client can opt to convert
+ *  this into a real number (integer or real) via jupdate() if they
+ *  choose, or have the parser do it as it goes (see #jp_numbers).
  *  Now, we could simply collect characters from a set [-+.0-9eE] and
  *  that would suffice, but instead, we'll do this the long way so
  *  that we can catch errors in bogus numeric fields (e.g.,
- *  "123.456.789"). */
-static char *
-readnumber( ifile *f )
+ *  "123.456.789").
+ *
+ *  Just as with strings, a number that's all there in the input, with
+ *  whatever ends it, is handed over from where it sits. Only one that
+ *  runs off the end of the buffer, or that's in error, is gathered up
+ *  a byte at a time. */
+static const char *
+readnumber( ifile *f, size_t *n )
 {
     int c;
-    twine tw = (twine){ 0 };
+    twine *tw = &f->tw;
+    const char *run = f->p + f->pos;
+    size_t avail = f->len - f->pos;
+    size_t k = numspan( run, run + avail );
+
+    if( k && ( k < avail ? run[k] == ',' || run[k] == ']' ||
+               run[k] == '}' || isspace( (unsigned char)run[k] ) : f->eof )) {
+        f->pos += k;
+        *n = k;
+        return run;
+    }
 
-    if(( c = getch( f )) == '-' )		/* sign bit */
-        twaddc( &tw, c );
-    else
-        ungetch( f, c );
+    tw->len = 0;
+
+    if(( c = peekch( f )) == '-' ) {		/* sign bit */
+        twaddc( tw, c );
+        ++f->pos;
+    }
 
     if(( c = getch( f )) == '0' ) {		/* integer */
-        twaddc( &tw, c );
+        twaddc( tw, c );
 	c = getch( f );
     } else if( isdigit( c ) && c != '0' ) {
         do {
-	    twaddc( &tw, c );
+	    twaddc( tw, c );
 	    c = getch( f );
 	} while( isdigit( c ));
     } else {
         ierr( f, "unexpected '%c'", c );
-	return readnumberfail( &tw );
+	return 0;
     }
 
     if( c == '.' )				/* fraction */
 	do {
-	    twaddc( &tw, c );
+	    twaddc( tw, c );
 	    c = getch( f );
 	} while( isdigit( c ));
 
     if( c == 'e' || c == 'E' ) {		/* exponent */
-	twaddc( &tw, c );
+	twaddc( tw, c );
 	c = getch( f );
 	if( c == '+' || c == '-' ) {
-	    twaddc( &tw, c );
+	    twaddc( tw, c );
 	    c = getch( f );
 	}
 	while( isdigit( c )) {
-	    twaddc( &tw, c );
+	    twaddc( tw, c );
 	    c = getch( f );
 	}
     }
 
     if( c == ',' || c == ']' || c == '}' )	/* acceptable term */
-	ungetch( f, c );
+	ungetch( f );
     else if( c != EOF && !isspace( c )) {	/* unacceptable */
         ierr( f, "unexpected '%c'", c );
-	return readnumberfail( &tw );
+	return 0;
     }
 
-    return twfinal( &tw );
+    *n = tw->len;
+    return tw->p;
 }
 
 /** The next characters in the file stream \a f must match the ones
@@ -378,155 +715,555 @@ must( ifile *f, const char *s )
     return false;
 }
 
-/** With the stream pointing to a JSON string, read the object element
- *  at this point. Returns a new jvalue, or null when there is an
+/** With the stream pointing to a JSON string, read the name of the
+ *  object element at this point and the colon after it, handing the
+ *  name to \a h. Its value comes next. Returns false when there is an
  *  error. */
-static jvalue *
-readobjel( ifile *f )
+static bool
+readkey( ifile *f, jhandler *h )
 {
-    char *n;
+    const char *n;
 
-    if( !( n = readstring( f )))
-        return 0;
+    if( !( n = readname( f )))
+        return false;
 
     if( getchskip( f ) != ':' ) {
         ierr( f, "expected colon in object element" );
-        free( n );
-        return 0;
+        return false;
     }
 
-    jvalue *j = readvalue( f );
-    if( !j )
-        free( n );
-    else
-        j->n = n;
-    return j;
+    return h->key( h, n );
 }
 
-/** Reads a series of values from the JSON input stream at \a f,
- *  storing it in the #u.v member of \a j. We're passed a
- *  discriminator so we know whether we're parsing a simple array or
- *  an object; an object is just an array with names and colons before
- *  it. Processing of the actual elements is pretty simple, actually.
- *  Returns false when a parsing error is detected (which is
- *  reported). */
+enum {
+    /** Set in an entry on the stack of open containers once the
+     *  container has had an element; see readvalue(). */
+    if_some = 0x10
+};
+
+/** Get the next value out of the file stream \a f, handing it to \a
+ *  h. Returns false on a parsing failure (with diagnostic(s) sent to
+ *  the standard error stream), or when \a h asks us to stop. If the
+ *  value in \a f is an array or an object, every value nested inside
+ *  of it is read as well. Any leading whitespace is skipped.
+ *
+ *  Rather than calling ourselves for each container, we keep track of
+ *  the ones that are open ourselves. The innermost is in \a t, with
+ *  \a some telling whether it has had an element yet; the ones around
+ *  it wait in #open, one byte apiece, holding the same for each. Each
+ *  time around, we read one value, or just the start of a container;
+ *  then, we work through the commas and closing brackets that follow
+ *  until we come to the next value. However deeply the input nests,
+ *  this takes no more of the C stack than a flat array does; nesting
+ *  deeper than #maxdepth is an error. An object is just an array with
+ *  names and colons before its values. */
 static bool
-readseries( jvalue *j, ifile *f, enum jtypes t )
+readvalue( ifile *f, jhandler *h )
 {
-    char term;
-    jvalue *(*reader)( ifile* ) = 0; /* reads an element */
+    twine *st = &f->open;
+    size_t limit = f->maxdepth ? f->maxdepth : j_max_depth;
+    size_t depth = 0;
+    enum jtypes t = jnull;
+    bool some = false;
+    const char *s;
+    size_t n;
+    int c;
 
-    switch( t ) {
-    case jarray:
-        term = ']';
-        reader = readvalue;
-        break;
-    case jobject:
-        term = '}';
-        reader = readobjel;
-        break;
-    default:
-        ierr( f, "internal error jtype %d in readseries", (int)t );
-        return false;
+    st->len = 0;
+    for( ;; ) {
+        switch(( c = skipws( f ))) {
+        case EOF:
+            earlyeof();
+            return false;
+        case 'f':
+            if( !must( f, "false" ) || !h->scalar( h, jfalse, 0, 0 ))
+                return false;
+            break;
+        case 'n':
+            if( !must( f, "null" ) || !h->scalar( h, jnull, 0, 0 ))
+                return false;
+            break;
+        case 't':
+            if( !must( f, "true" ) || !h->scalar( h, jtrue, 0, 0 ))
+                return false;
+            break;
+        case '{': case '[':
+            if( depth == limit ) {
+                ierr( f, "nested more than %zu deep", limit );
+                return false;
+            }
+            if( depth++ )
+                twaddc( st, some ? t | if_some : t );
+            t = c == '{' ? jobject : jarray;
+            some = false;
+            getch( f );
+            if( !h->begin( h, t ))
+                return false;
+            break;
+        case '"':
+            if( !( s = readstr( f, &n )) || !h->scalar( h, jstring, s, n ))
+                return false;
+            break;
+        case '-': case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            if( !( s = readnumber( f, &n )) || !h->scalar( h, jnumber, s, n ))
+                return false;
+            break;
+        default:
+            ierr( f, "unexpected '%c'", (char)c );
+            return false;
+        }
+
+        /* Now, on to whatever's next in the innermost container: a
+         * comma, its end, or another element. */
+
+        for( ;; ) {
+            if( !depth )
+                return true;
+
+            c = skipws( f );
+            if( c == EOF ) {
+                earlyeof();
+                return false;
+
+            } else if( c == ',' ) {
+                if( !some ) {
+                    ierr( f, "missing value before comma" );
+                    return false;
+                }
+                getch( f );             /* consume the , */
+
+            } else if( c == ( t == jobject ? '}' : ']' )) {
+                getch( f );             /* we're done with this one */
+                if( !h->end( h, t ))
+                    return false;
+                if( --depth ) {
+                    c = st->p[ --st->len ];
+                    t = (enum jtypes)( c & ~if_some );
+                    some = c & if_some;
+                }
+
+            } else {
+                some = true;
+                if( t == jobject && !readkey( f, h ))
+                    return false;
+                break;
+            }
+        }
     }
+}
 
-    /* Peeking ahead in the stream saw [ or { which is how we got
-       called. So go ahead and throw it away. */
-    getch( f );
+/** Skip over the next value at \a f, along with any leading
+ *  whitespace, without reading it: nothing is copied, decoded, or
+ *  handed to anyone. We only go from one token to the next, counting
+ *  brackets, until the ones we opened are closed; that's all it takes
+ *  to find the end of the value, since the scanner has found the
+ *  strings for us. Nothing inside is checked, beyond that. Returns
+ *  false (after a diagnostic) if the value never ends. */
+static bool
+skipvalue( ifile *f )
+{
+    size_t depth = 0;
+    int c = skipws( f );
 
-    ptrvec pv = (ptrvec){ 0 };
-    for( bool oops = false; !oops; ) {
-        jvalue *x = 0;
-        int c = skipws( f );
-        
+    if( c == ']' || c == '}' || c == ',' || c == ':' ) {
+        ierr( f, "unexpected '%c'", c );
+        return false;
+    }
+    for( ;; c = nexttoken( f )) {
         if( c == EOF ) {
             earlyeof();
-            oops = true;
+            return false;
+        }
+        if( c == '[' || c == '{' )
+            ++depth;
+        else if( c == ']' || c == '}' )
+            --depth;
+        if( !depth )
+            break;
+    }
 
-        } else if( c == ',' ) {
-            if( pv.len == 0 ) {
-                ierr( f, "missing value before comma" );
-                oops = true;
-            }
-            getch( f );             /* consume the , */
+    /* We're at the end of a container, or on the only token of a
+     * scalar, which ends wherever the next token begins. */
 
-        } else if( c == term ) {     /* we're done! */
-            getch( f );             /* consume the } */
-            j->u.v = (jvalue**)pvfinal( &pv );
-            return true;
+    if( c == ']' || c == '}' )
+        ++f->pos;
+    else
+        nexttoken( f );
+    return true;
+}
 
-        } else if( !( x = reader( f )))
-            oops = true;
+/** Returns true if the \a n bytes at \a s are the same as the piece
+ *  of a JSON Pointer from \a p up to \a end, in which ~1 stands for a
+ *  slash and ~0 for a tilde. */
+static bool
+segis( const char *p, const char *end, const char *s, size_t n )
+{
+    for( ; p < end; ++p, ++s, --n ) {
+        char c = *p;
+        if( c == '~' && p + 1 < end && ( p[1] == '0' || p[1] == '1' ))
+            c = *++p == '0' ? '~' : '/';
+        if( !n || *s != c )
+            return false;
+    }
+    return !n;
+}
 
+/** Returns the array index that the piece of a JSON Pointer from \a p
+ *  up to \a end stands for, or -1 if it doesn't stand for one. */
+static long long
+segindex( const char *p, const char *end )
+{
+    long long k = 0;
+
+    if( p == end || ( *p == '0' && end - p > 1 ))
+        return -1;
+    for( ; p < end; ++p )
+        if( *p < '0' || *p > '9' || k > ( LLONG_MAX - 9 ) / 10 )
+            return -1;
         else
-            pvadd( &pv, x );
-    }
+            k = k * 10 + ( *p - '0' );
+    return k;
+}
 
-    pvclear( &pv );
+/** Report that there's nothing at #path in the value at \a f. */
+static bool
+notfound( const ifile *f )
+{
+    ierr( f, "nothing at %s", f->path );
     return false;
 }
 
-/** Get the next value out of the file stream \a f, storing it in a
- *  jvalue newly allocated from the heap. Returns 0 on a parsing
- *  failure (with diagnostic(s) sent to the standard error stream).
- *  This function is recursive; if the value in \a f is an array or an
- *  object, a properly nested jvalue tree is returned. Any leading
- *  whitespace is skipped. */
-static jvalue *
-readvalue( ifile *f )
+/** With the stream at \a f just before the name of an object member,
+ *  or the whitespace ahead of it, read the name and the colon after
+ *  it. Given \a hit, it's set to whether the name is the piece of a
+ *  path from \a seg up to \a end; see segis(). That has to be settled
+ *  before we go looking for the colon, since the name may be sitting
+ *  right in the input buffer, which reading more would overwrite.
+ *  Returns false (after a diagnostic) if there's no name. */
+static bool
+member( ifile *f, const char *seg, const char *end, bool *hit )
 {
-    int c;
-    jvalue *j = jnew();
+    size_t k;
+    const char *s;
+
+    skipws( f );
+    if( !( s = readstr( f, &k )))
+        return false;
+    if( hit )
+        *hit = segis( seg, end, s, k );
+    if( getchskip( f ) != ':' ) {
+        ierr( f, "expected colon in object element" );
+        return false;
+    }
+    return true;
+}
+
+/** With the stream at \a f just past an element of a container, a \a
+ *  t, or just past its opening bracket if \a first is true, move on to
+ *  the next element, past its name and colon, too, in an object (see
+ *  member() for \a seg, \a end, and \a hit). Returns 1 if there is
+ *  one; 0, with the closing bracket consumed, if the container ended
+ *  instead; or -1 (after a diagnostic) on an error. */
+static int
+nextel( ifile *f, enum jtypes t, bool first, const char *seg,
+        const char *end, bool *hit )
+{
+    int c = skipws( f );
 
-    switch(( c = skipws( f ))) {
-    case EOF:
+    if( c == ( t == jobject ? '}' : ']' )) {
+        ++f->pos;
+        return 0;
+    } else if( c == EOF ) {
         earlyeof();
-        break;
-    case 'f':
-        if( must( f, "false" )) {
-            j->d = jfalse;
-            return j;
+        return -1;
+    } else if( !first ) {
+        if( c != ',' ) {
+            ierr( f, "unexpected '%c'", c );
+            return -1;
         }
-        break;
-    case 'n':
-        if( must( f, "null" )) {
-            j->d = jnull;
-            return j;
-        }
-        break;
-    case 't':
-        if( must( f, "true" )) {
-            j->d = jtrue;
-            return j;
-        }
-        break;
-    case '{':
-        if( readseries( j, f, j->d = jobject ))
-            return j;
-        break;
-    case '[':
-        if( readseries( j, f, j->d = jarray ))
-            return j;
-        break;
-    case '"':
-        if(( j->u.s = readstring( f ))) {
-            j->d = jstring;
-            return j;
+        ++f->pos;
+    }
+    return t != jobject || member( f, seg, end, hit ) ? 1 : -1;
+}
+
+/** Move \a f along to the value at #path, within the value about to
+ *  be read, skipping everything before it with skipvalue(). The path
+ *  is a JSON Pointer: a name or an index for each level, each after a
+ *  slash, as in "/data/items/0". The arrays and objects we go into on
+ *  the way are left in \a outer, one byte apiece, for leave(). Returns
+ *  false (after a diagnostic) if there's nothing there. */
+static bool
+seek( ifile *f, twine *outer )
+{
+    const char *p = f->path;
+
+    if( *p && *p != '/' ) {
+        err( "bad JSON path %s", p );
+        return false;
+    }
+    outer->len = 0;
+    while( *p == '/' ) {
+        const char *seg = ++p, *end = seg + strcspn( seg, "/" );
+        long long k = 0;
+        enum jtypes t;
+        bool hit = false;
+        int in;
+
+        switch( skipws( f )) {
+        case '{': t = jobject; break;
+        case '[': t = jarray; k = segindex( seg, end ); break;
+        case EOF: earlyeof(); return false;
+        default: return notfound( f );
         }
-        break;
-    case '-': case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-        if(( j->u.s = readnumber( f ))) {
-            j->d = jnumber;
-            return j;
+        if( k < 0 )
+            return notfound( f );
+        ++f->pos;
+        twaddc( outer, t );
+
+        for( in = nextel( f, t, true, seg, end, &hit ); in > 0;
+             in = nextel( f, t, false, seg, end, &hit )) {
+            if( t == jobject ? hit : !k-- )
+                break;
+            if( !skipvalue( f ))
+                return false;
         }
-        break;
-    default:
-        ierr( f, "unexpected '%c'", (char)c );
+        if( in < 0 )
+            return false;
+        if( !in )
+            return notfound( f );
+        p = end;
+    }
+    return true;
+}
+
+/** Having read the value that seek() found, skip the rest of the
+ *  containers it went into to get there, listed in \a outer, the
+ *  innermost last, so that \a f is left just past the end of the
+ *  whole value. Returns false (after a diagnostic) if any of them are
+ *  broken. */
+static bool
+leave( ifile *f, const twine *outer )
+{
+    for( size_t i = outer->len; i--; ) {
+        enum jtypes t = (enum jtypes)outer->p[i];
+        int in;
+
+        while(( in = nextel( f, t, false, 0, 0, 0 )) > 0 )
+            if( !skipvalue( f ))
+                return false;
+        if( in < 0 )
+            return false;
     }
+    return true;
+}
 
-    jdel( j );
-    return 0;
+/** Read just the part of the next value at \a f that's at #path,
+ *  handing it to \a h as readvalue() would, and nothing else; the
+ *  rest is skipped over with skipvalue(), and never reaches \a h at
+ *  all. If \a rest is true, the rest of the value after that part is
+ *  skipped, too, as it must be when there's another value after it;
+ *  otherwise, we stop as soon as we have what we came for. */
+static bool
+project( ifile *f, jhandler *h, bool rest )
+{
+    twine outer = (twine){ 0 };
+    bool ok = seek( f, &outer ) && readvalue( f, h )
+        && ( !rest || leave( f, &outer ));
+
+    twclear( &outer );
+    return ok;
+}
+
+/** The guts of every entry point, once they've set up \a f. A single
+ *  value is read and handed to \a h, and \a f is cleaned up. */
+static bool
+parse( ifile *f, jhandler *h )
+{
+    bool ok = f->path ? project( f, h, false ) : readvalue( f, h );
+
+    free( f->buf );
+    free( f->bits );
+    twclear( &f->tw );
+    twclear( &f->open );
+    return ok;
+}
+
+/** One container in a tree being built by a jbuild: the jvalue, and
+ *  the elements it has collected so far. */
+typedef struct jlevel {
+    jvalue *j;                  /**< The array or object */
+    size_t base;                /**< Where its elements begin in #kids */
+    unsigned census;            /**< Their census, so far */
+} jlevel;
+
+/** This is how jparse() builds a tree; it's just another handler for
+ *  the events coming out of the parser. Each container being built
+ *  has a jlevel on a stack. The elements of every container still
+ *  open go onto one more stack, #kids, the innermost container's
+ *  last; once a container ends, its elements are right at the top,
+ *  and they're copied from there into a vector of exactly the right
+ *  size in the arena, and popped. Both stacks are kept from one
+ *  container to the next, so building even a huge tree takes only a
+ *  handful of trips to the heap, however many containers it has. */
+typedef struct jbuild {
+    jhandler h;                 /**< Our handler; must come first */
+    jdoc *d;                    /**< The document being built */
+    const char *name;           /**< The name for the next value */
+    jlevel *lv;                 /**< Our stack of containers */
+    size_t depth;               /**< How many of #lv are in use */
+    size_t sz;                  /**< How many of #lv there are */
+    ptrvec kids;                /**< The elements of all of them */
+    unsigned flags;             /**< Our options, from jpflags */
+} jbuild;
+
+/** Returns a new node of type \a t for the tree at \a b, named and
+ *  placed in its container. The very first one is the root. */
+static jvalue *
+bnode( jbuild *b, enum jtypes t )
+{
+    jvalue *j;
+
+    if( b->depth ) {
+        j = aralloc( &b->d->a, sizeof( *j ));
+        pvadd( &b->kids, j );
+    } else
+        j = &b->d->root;
+
+    j->nt = (uintptr_t)b->name | t;
+    b->name = 0;
+    return j;
+}
+
+/** Add \a c to the census of the innermost container in the tree at
+ *  \a b, if there is one; see jcensus(). */
+static void
+btally( jbuild *b, unsigned c )
+{
+    if( b->depth )
+        b->lv[ b->depth - 1 ].census |= c;
+}
+
+/** A jhandler function, which begins a new container in a tree. */
+static bool
+bbegin( jhandler *h, enum jtypes t )
+{
+    jbuild *b = (jbuild *)h;
+    jvalue *j = bnode( b, t );
+
+    btally( b, 1u << t );
+    if( b->depth == b->sz ) {
+        b->sz = b->sz ? b->sz * 2 : 16;
+        b->lv = erealloc( b->lv, b->sz * sizeof( *b->lv ));
+    }
+    b->lv[ b->depth++ ] = (jlevel){ .j = j, .base = b->kids.len };
+    return true;
+}
+
+/** A jhandler function, which remembers the name of the next value in
+ *  a tree. */
+static bool
+bkey( jhandler *h, const char *n )
+{
+    ( (jbuild *)h )->name = n;
+    return true;
+}
+
+/** Make \a j the jint or jreal for the JSON number in the \a n bytes
+ *  at \a s, allocating a real from \a a. This is the conversion that
+ *  jupdate() does, and that #jp_numbers does during the parse. */
+static void
+decode( arena *a, jvalue *j, const char *s, size_t n )
+{
+    long long i;
+    long double r;
+
+    if( fmtparse( s, n, &i, &r )) {
+        j->u.i = i;
+        jsettype( j, jint );
+    } else {
+        long double *p = aralloc( a, sizeof( *p ));
+        *p = r;
+        j->u.r = p;
+        jsettype( j, jreal );
+    }
+}
+
+/** A jhandler function, which adds a terminal value to a tree. */
+static bool
+bscalar( jhandler *h, enum jtypes t, const char *s, size_t n )
+{
+    jbuild *b = (jbuild *)h;
+    jvalue *j = bnode( b, t );
+
+    /* We know how long a number is here, so looking for its decimal
+     * point needn't look for its end as well. */
+
+    if( t == jnumber && ( b->flags & jp_numbers )) {
+        decode( &b->d->a, j, s, n );
+        btally( b, 1u << jtype( j ));
+    } else {
+        j->u.s = s ? ardup( &b->d->a, s, n ) : 0;
+        btally( b, t == jnumber && memchr( s, '.', n ) ?
+                1u << t | jc_frac : 1u << t );
+    }
+    return true;
+}
+
+/** A jhandler function, which completes the innermost container in a
+ *  tree, giving it its vector of elements and their census. */
+static bool
+bend( jhandler *h, enum jtypes t )
+{
+    jbuild *b = (jbuild *)h;
+    jlevel *l = &b->lv[ --b->depth ];
+
+    (void)t;
+    setvec( &b->d->a, l->j, (jvalue **)b->kids.p + l->base,
+            b->kids.len - l->base, l->census );
+    b->kids.len = l->base;
+    return true;
+}
+
+/** Set up \a b to build a tree in the document \a d. */
+static void
+binit( jbuild *b, jdoc *d )
+{
+    *b = (jbuild){
+        .h = { .begin = bbegin, .key = bkey, .scalar = bscalar,
+               .end = bend },
+        .d = d
+    };
+}
+
+/** Release the stacks of \a b, leaving its document alone. */
+static void
+bfree( jbuild *b )
+{
+    pvclear( &b->kids );
+    free( b->lv );
+    b->lv = 0;
+    b->sz = 0;
+}
+
+/** Build a new document from the input at \a f, with the options in
+ *  \a flags, returning its root, or a null if the parse failed. */
+static jvalue *
+build( ifile *f, unsigned flags )
+{
+    jbuild b;
+
+    binit( &b, (jdoc *)jnew());
+    b.flags = flags;
+    f->names = &b.d->names;
+    bool ok = parse( f, &b.h );
+    bfree( &b );
+
+    if( !ok ) {
+        jdel( &b.d->root );
+        return 0;
+    }
+    return &b.d->root;
 }
 
 /** Parse the opened for reading file stream \a into a new jvalue,
@@ -536,74 +1273,549 @@ readvalue( ifile *f )
  *  printed to stderr). This is slightly more liberal than the JSON
  *  standard, in that the outermost value of the stream at \a fp
  *  isn't limited to being just an array or object, but can also be
- *  any other JSON value. */
+ *  any other JSON value. Input is read in large blocks directly from
+ *  the descriptor beneath \a fp, bypassing its stdio buffer; nothing
+ *  should have been read from \a fp beforehand, and its position is
+ *  unspecified afterwards. */
 jvalue *
 jparse( FILE *fp )
+{
+    return jparsef( fp, 0 );
+}
+
+/** Just like jparse(), but with the options in \a flags, or'ed
+ *  together from jpflags. */
+jvalue *
+jparsef( FILE *fp, unsigned flags )
+{
+    return jparsep( fp, 0, flags );
+}
+
+/** Just like jparsef(), but the tree is made of only the part of the
+ *  document at \a path, a JSON Pointer (RFC 6901) such as
+ *  "/data/items"; an empty or null path is the whole document. The
+ *  rest is skipped without being read, beyond finding where each
+ *  value ends, so the time it takes depends mostly on how big the
+ *  part is, and only a little on how big the rest of the document is.
+ *  Returns a null, with a diagnostic, if there's nothing at \a path.
+ *  Nothing after the part is read at all. */
+jvalue *
+jparsep( FILE *fp, const char *path, unsigned flags )
 {
     if( !fp )
         return 0;
 
-    ifile f = (ifile){ .fp = fp, .line = 1 };
-    return readvalue( &f );
-}
-
-/** This is only used by jupdate, so we hide it static to this file.
- *  It returns true if the supplied string appears to just be an
- *  integer number.  Specifically, this means it does not contain an
- *  exponent nor a decimal point, as those typically introduce reals.
- *  It's arguable that an exponent, itself, doesn't necessarily mean
- *  a value is a real.  But, because it's so easy to exceed the range
- *  of an integer with a really huge exponent, nothing short of
- *  parsing the number itself makes it a safe call to deal with
- *  exponential integers.  So, exponents mean "not integer".  Also,
- #  because we assume that we're parsing numbers gathered by
- *  readnumber() via jparse(), we don't bother testing on isdigit()
- #  like a well behaved function would; otherwise, failing isdigit()
- #  in the while loop would also be an immediate return false. */
+    ifile f = (ifile){ .fd = fileno( fp ), .line = 1, .path = path };
+    return build( &f, flags );
+}
+
+/** Just like jparse(), but the JSON document is the \a len bytes
+ *  already sitting in memory at \a buf; a file mapped with mmap(2),
+ *  for example. The parser reads straight from \a buf, which is never
+ *  modified, and no longer needed once this returns. */
+jvalue *
+jparse_mem( const char *buf, size_t len )
+{
+    return jparsef_mem( buf, len, 0 );
+}
+
+/** Just like jparse_mem(), but with the options in \a flags, as for
+ *  jparsef(). */
+jvalue *
+jparsef_mem( const char *buf, size_t len, unsigned flags )
+{
+    return jparsep_mem( buf, len, 0, flags );
+}
+
+/** Just like jparse_mem(), but with only the part at \a path, as for
+ *  jparsep(). */
+jvalue *
+jparsep_mem( const char *buf, size_t len, const char *path, unsigned flags )
+{
+    if( !buf )
+        return 0;
+
+    ifile f = (ifile){ .fd = -1, .p = buf, .len = len, .line = 1,
+                       .eof = true, .path = path };
+    return build( &f, flags );
+}
+
+/** The guts of jevents() and jevents_mem(), once they've set up \a f.
+ *  The names handed to \a h are interned in a table of our own, which
+ *  lasts just as long as the parse does. */
 static bool
-integerp( const char *str )
+events( ifile *f, jhandler *h )
 {
-    if( *str == '-' || *str == '+' )
-        ++str;
-    while( *str )
-        if( *str == '.' || *str == 'e' || *str == 'E' )
-            return false;
-	else
-	    ++str;
-    return true;
+    intab names = (intab){ 0 };
+
+    f->names = &names;
+    bool ok = parse( f, h );
+    inclear( &names );
+    return ok;
+}
+
+/** Parse the JSON document waiting on \a fp just like jparse(), but
+ *  rather than building a tree, hand each piece of it to \a h as it
+ *  is read (see jhandler). Nothing is kept once it has been handed
+ *  over, so the memory needed depends only on how deeply the document
+ *  nests, not on how big it is. Returns false if the parse failed (a
+ *  diagnostic will have been printed) or \a h stopped it early. */
+bool
+jevents( FILE *fp, jhandler *h )
+{
+    return jeventsp( fp, 0, h );
+}
+
+/** Just like jevents(), but only the part of the document at \a path
+ *  is handed to \a h, as for jparsep(). */
+bool
+jeventsp( FILE *fp, const char *path, jhandler *h )
+{
+    if( !fp )
+        return false;
+
+    ifile f = (ifile){ .fd = fileno( fp ), .line = 1, .path = path };
+    return events( &f, h );
 }
 
-/** Given a jvalue, "update" it or its children. "Update" means
- *  several things, but it basically finishes the work started by
- *  jparse(). jparse() implements a quick parse of a JSON stream, but
- *  does things like leaving numbers as strings, in the event that the
- *  caller doesn't need lossy conversions introduced by atof().
- *  Calling jupdate() effectively "finishes" the parse, converting
- *  everything into native formats. */
+/** Just like jevents(), but the JSON document is the \a len bytes
+ *  already sitting in memory at \a buf, as with jparse_mem(). */
+bool
+jevents_mem( const char *buf, size_t len, jhandler *h )
+{
+    return jeventsp_mem( buf, len, 0, h );
+}
+
+/** Just like jevents_mem(), but with only the part at \a path, as for
+ *  jparsep(). */
+bool
+jeventsp_mem( const char *buf, size_t len, const char *path, jhandler *h )
+{
+    if( !buf )
+        return false;
+
+    ifile f = (ifile){ .fd = -1, .p = buf, .len = len, .line = 1,
+                       .eof = true, .path = path };
+    return events( &f, h );
+}
+
+/** A reader works through a series of JSON documents, one after
+ *  another in the same input; one per line, for example, as in
+ *  NDJSON. Everything that goes into parsing a document stays put
+ *  from one to the next: the input buffer, the scanner, the stack of
+ *  the tree builder, and the document itself. The document's arena is
+ *  merely reset between them, keeping its memory, and its table of
+ *  names lives as long as the reader does. Once things get going,
+ *  parsing another document hardly ever involves the heap at all. */
+struct jreader {
+    ifile f;                    /**< Our input */
+    jbuild b;                   /**< Builds each tree in turn */
+    bool failed;                /**< A document was bad */
+};
+
+/** The guts of jropen() and jropen_mem(), once \a f is set up. */
+static jreader *
+ropen( ifile f )
+{
+    jreader *r = emalloc( sizeof( *r ));
+
+    *r = (jreader){ .f = f };
+    binit( &r->b, (jdoc *)jnew());
+    r->f.names = &r->b.d->names;
+    return r;
+}
+
+/** Open a reader over the series of JSON documents waiting on \a fp.
+ *  Just as with jparse(), the input is read directly from the
+ *  descriptor beneath \a fp. Documents may be separated by any amount
+ *  of whitespace, or none at all, if there's no ambiguity. Hand them
+ *  over one at a time with jrnext() or jrevents(), and when you're
+ *  done, close the reader with jrclose(). */
+jreader *
+jropen( FILE *fp )
+{
+    return ropen( (ifile){ .fd = fileno( fp ), .line = 1 } );
+}
+
+/** Just like jropen(), but the documents are the \a len bytes already
+ *  sitting in memory at \a buf, as with jparse_mem(). They must stay
+ *  there until the reader is closed. */
+jreader *
+jropen_mem( const char *buf, size_t len )
+{
+    return ropen( (ifile){ .fd = -1, .p = buf, .len = len, .line = 1,
+                           .eof = true } );
+}
+
+/** Tell \a r that its input begins on line \a line of something
+ *  bigger, such as one piece of a larger file, so that any errors are
+ *  reported against the line in the whole. Call this before handing
+ *  out any documents. */
+void
+jrline( jreader *r, size_t line )
+{
+    r->f.line = line;
+}
+
+/** Build the documents that \a r hands out with jrnext() with the
+ *  options in \a flags, as for jparsef(). */
+void
+jrflags( jreader *r, unsigned flags )
+{
+    r->b.flags = flags;
+}
+
+/** Let the documents at \a r nest no more than \a depth arrays and
+ *  objects deep; one that goes deeper is bad. Zero means the default,
+ *  #j_max_depth. */
+void
+jrdepth( jreader *r, size_t depth )
+{
+    r->f.maxdepth = depth;
+}
+
+/** Hand out only the part of each document at \a r that's at \a
+ *  path, as for jparsep(), rather than the whole thing; the rest of
+ *  each is skipped. A document with nothing there is bad. The path
+ *  must last as long as the reader does. */
+void
+jrpath( jreader *r, const char *path )
+{
+    r->f.path = path;
+}
+
+/** Read the next value at \a r, or just the part of it at its path,
+ *  if it has one, handing it to \a h. */
+static bool
+rvalue( jreader *r, jhandler *h )
+{
+    return r->f.path ? project( &r->f, h, true ) : readvalue( &r->f, h );
+}
+
+/** Returns true if there's another document waiting at \a r. */
+static bool
+rmore( jreader *r )
+{
+    return !r->failed && skipws( &r->f ) != EOF;
+}
+
+/** Parse the next document at \a r into a tree, returning its root;
+ *  or a null, when there are no more documents or the next one was
+ *  bad (see jrfailed()). The tree belongs to the reader, and is only
+ *  good until the next call to jrnext() or jrclose(); never hand it
+ *  to jdel(). Its names, though, last as long as the reader does. */
 jvalue *
-jupdate( jvalue *j )
-{
-    if( j )
-        switch( j->d ) {
-        case jnumber:
-	    if( integerp( j->u.s )) {
-                j->u.i = strtoll( j->u.s, 0, 10 );
-                j->d = jint;
-            } else {
-                j->u.r = strtold( j->u.s, 0 );
-                j->d = jreal;
+jrnext( jreader *r )
+{
+    if( !rmore( r ))
+        return 0;
+
+    jdoc *d = r->b.d;
+    arreset( &d->a );
+    d->root = (jvalue){ 0 };
+    r->b.depth = 0;
+    r->b.kids.len = 0;
+    r->b.name = 0;
+
+    if( !rvalue( r, &r->b.h )) {
+        r->failed = true;
+        return 0;
+    }
+    return &d->root;
+}
+
+/** Parse the next document at \a r, handing it to \a h just as
+ *  jevents() would. Returns false when there are no more documents,
+ *  or the next one was bad (see jrfailed()), or \a h stopped it
+ *  early. Names handed to \a h last as long as the reader does. */
+bool
+jrevents( jreader *r, jhandler *h )
+{
+    if( !rmore( r ))
+        return false;
+    if( !rvalue( r, h )) {
+        r->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/** Returns true if jrnext() or jrevents() gave up on a document, as
+ *  opposed to simply running out of them. No more documents can be
+ *  had from \a r after that. */
+bool
+jrfailed( const jreader *r )
+{
+    return r->failed;
+}
+
+/** Close the reader \a r, releasing all of its memory, including the
+ *  last tree returned by jrnext(). Once called, \a r is <em>no longer
+ *  valid.</em> */
+void
+jrclose( jreader *r )
+{
+    if( r ) {
+        free( r->f.buf );
+        free( r->f.bits );
+        twclear( &r->f.tw );
+        twclear( &r->f.open );
+        bfree( &r->b );
+        jdel( &r->b.d->root );
+        free( r );
+    }
+}
+
+/** Returns how many documents there are in the series of them at \a
+ *  buf, without parsing them; the \a len bytes there are just what
+ *  jropen_mem() would take. Only the scanner looks at them, and every
+ *  token that begins outside of any array or object begins another
+ *  document. That's exact for any series of good documents, and runs
+ *  many times faster than a parse, which is the point: it tells us
+ *  where a piece of a series stands in the whole, long before the
+ *  pieces before it have been parsed. */
+size_t
+jrcount( const char *buf, size_t len )
+{
+    ifile f = (ifile){ .fd = -1, .p = buf, .len = len, .line = 1,
+                       .eof = true };
+    size_t n = 0, depth = 0;
+
+    /* The very first byte can begin a scalar as well, just as though
+     * some whitespace had come before it. */
+
+    f.sc.pred = 1;
+    while( scanmore( &f )) {
+        size_t end = f.ie < len ? f.ie : len;
+        for( size_t i = nexttok( &f, f.ib ); i < end;
+             i = nexttok( &f, i + 1 ))
+            switch( buf[i] ) {
+            case '[': case '{':
+                n += !depth++;
+                break;
+            case ']': case '}':
+                depth -= depth > 0;
+                break;
+            case ':': case ',':
+                break;
+            default:
+                n += !depth;
+                break;
             }
+    }
+    free( f.bits );
+    return n;
+}
+
+enum {
+    /** How many elements of an array (or members of an object)
+     *  jupdate_mt() hands to a thread at a time. Anything with fewer
+     *  than this is converted by whoever comes across it. */
+    ju_grain = 4096
+};
+
+/** A run of the elements of one array, for a thread to convert. */
+typedef struct juslice {
+    jvalue *j;                  /**< The array */
+    jvalue **v;                 /**< The first element */
+    size_t n;                   /**< How many there are */
+    unsigned census;            /**< Their census, once converted */
+} juslice;
+
+/** What the threads of jupdate_mt() share: the slices still to be
+ *  converted, handed out in order under #mu. */
+typedef struct jupool {
+    pthread_mutex_t mu;         /**< Guards #next */
+    juslice *s;                 /**< Every slice */
+    size_t n;                   /**< How many slices are at #s */
+    size_t sz;                  /**< How many slices #s can hold */
+    size_t next;                /**< The next one to hand out */
+} jupool;
+
+/** One of the threads of jupdate_mt(), with an arena of its own for
+ *  the reals it comes across. */
+typedef struct juthread {
+    jupool *pl;                 /**< Where the work comes from */
+    arena a;                    /**< Where its reals go */
+    pthread_t t;                /**< The thread itself */
+    bool started;               /**< #t was created, and needs joining */
+} juthread;
+
+/** One array or object that update() is partway through. */
+typedef struct jframe {
+    jvalue *j;                  /**< The array or object */
+    jvalue **v;                 /**< Its next element */
+    unsigned census;            /**< The census of the ones before it */
+} jframe;
+
+/** The stack that update() keeps in place of recursion. Zero one out
+ *  before use, and free #f after; it can be used over and over in
+ *  between. */
+typedef struct jstack {
+    jframe *f;                  /**< The containers being converted */
+    size_t sz;                  /**< How many of #f there's room for */
+} jstack;
+
+/** If \a j, an array or object, has enough elements to be worth it,
+ *  slice them up into \a pl and return true; otherwise, return false.
+ *  The census of the slices is taken by whoever converts them, and
+ *  added up once they're all done. */
+static bool
+slice( jupool *pl, jvalue *j )
+{
+    size_t n = 0;
+
+    while( j->u.v[n] )
+        ++n;
+    if( n < ju_grain )
+        return false;
+
+    setcensus( j, 0 );
+    for( size_t i = 0; i < n; i += ju_grain ) {
+        if( pl->n == pl->sz ) {
+            pl->sz = pl->sz ? 2 * pl->sz : 64;
+            pl->s = erealloc( pl->s, pl->sz * sizeof( *pl->s ));
+        }
+        pl->s[ pl->n++ ] = (juslice){
+            .j = j, .v = j->u.v + i,
+            .n = n - i < ju_grain ? n - i : ju_grain
+        };
+    }
+    return true;
+}
+
+/** The guts of jupdate(), converting \a j and everything under it,
+ *  and taking a new census of every container on the way. Reals are
+ *  allocated out of the arena \a a. Given a pool \a pl, as jupdate_mt()
+ *  does, the elements of any big array are left alone, and sliced up
+ *  into it instead; what's left is converted on the spot, which is
+ *  everything in a typical document but its one or two huge arrays.
+ *
+ *  Rather than calling ourselves for each container, we push it onto
+ *  \a st and carry on with its first element. Once a value is
+ *  converted, the next one is the next element of the container on
+ *  top of the stack, and a container with none left gets its census
+ *  and is popped. */
+static void
+update( arena *a, jstack *st, jupool *pl, jvalue *j )
+{
+    size_t len = 0;
+
+    for( ;; ) {
+        enum jtypes t = jtype( j );
+
+        if( t == jnumber )
+            decode( a, j, j->u.s, strlen( j->u.s ));
+        if( len )
+            st->f[ len - 1 ].census |= census( j );
+        if(( t == jarray || t == jobject ) && !( pl && slice( pl, j ))) {
+            if( len == st->sz ) {
+                st->sz = st->sz ? 2 * st->sz : 16;
+                st->f = erealloc( st->f, st->sz * sizeof( *st->f ));
+            }
+            st->f[ len++ ] = (jframe){ .j = j, .v = j->u.v };
+        }
+
+        while( len && !*st->f[ len - 1 ].v ) {
+            jframe *f = &st->f[ --len ];
+            setcensus( f->j, f->census );
+        }
+        if( !len )
+            return;
+        j = *st->f[ len - 1 ].v++;
+    }
+}
+
+/** Given the root of a document, "update" it and all of its
+ *  children. "Update" means several things, but it basically finishes
+ *  the work started by jparse(). jparse() implements a quick parse of
+ *  a JSON stream, but does things like leaving numbers as strings, in
+ *  the event that the caller doesn't need lossy conversions
+ *  introduced by atof(). Calling jupdate() effectively "finishes" the
+ *  parse, converting everything into native formats. A number written
+ *  as an integer becomes a jint, if it fits in one; anything else
+ *  becomes a jreal. Since reals are kept in the document, \a root must
+ *  be the root of one (as returned by jnew() or jparse()). */
+jvalue *
+jupdate( jvalue *root )
+{
+    if( root ) {
+        jstack st = (jstack){ 0 };
+        update( &( (jdoc *)root )->a, &st, 0, root );
+        free( st.f );
+    }
+
+    return root;
+}
+
+/** The body of each thread of jupdate_mt(), the calling one included:
+ *  take slices until they're all gone, converting everything in
+ *  them. */
+static void *
+upthread( void *arg )
+{
+    juthread *t = arg;
+    jupool *pl = t->pl;
+    jstack st = (jstack){ 0 };
+
+    for( ;; ) {
+        pthread_mutex_lock( &pl->mu );
+        juslice *s = pl->next < pl->n ? &pl->s[ pl->next++ ] : 0;
+        pthread_mutex_unlock( &pl->mu );
+        if( !s )
             break;
-        case jarray:
-	case jobject:
-            for( jvalue **jv = j->u.v; *jv; ++jv )
-                jupdate( *jv );
-            break;
-        default:
-            break;
+        for( size_t i = 0; i < s->n; ++i ) {
+            update( &t->a, &st, 0, s->v[i] );
+            s->census |= census( s->v[i] );
         }
+    }
+    free( st.f );
+    return 0;
+}
 
-    return j;
+/** Just like jupdate(), but with up to \a threads threads converting
+ *  the elements of big arrays at once. The rest of the document is
+ *  converted first, by the calling thread, while it looks for them.
+ *  Each thread keeps its reals in an arena of its own, and these are
+ *  merged into the document's once all are done. If a thread can't
+ *  be had, the others just do more of the work. */
+jvalue *
+jupdate_mt( jvalue *root, unsigned threads )
+{
+    if( !root )
+        return root;
+    if( threads <= 1 )
+        return jupdate( root );
+
+    arena *a = &( (jdoc *)root )->a;
+    jupool pl = (jupool){ .n = 0 };
+
+    jstack st = (jstack){ 0 };
+    update( a, &st, &pl, root );
+    free( st.f );
+    if( pl.n ) {
+        if( threads > pl.n )
+            threads = pl.n;
+
+        juthread *t = emalloc( threads * sizeof( *t ));
+        pthread_mutex_init( &pl.mu, 0 );
+        for( unsigned i = 0; i < threads; ++i )
+            t[i] = (juthread){ .pl = &pl };
+        for( unsigned i = 1; i < threads; ++i )
+            t[i].started = !pthread_create( &t[i].t, 0, upthread, &t[i] );
+        upthread( &t[0] );
+        for( unsigned i = 0; i < threads; ++i ) {
+            if( t[i].started )
+                pthread_join( t[i].t, 0 );
+            armerge( a, &t[i].a );
+        }
+        for( size_t i = 0; i < pl.n; ++i )
+            setcensus( pl.s[i].j, jcensus( pl.s[i].j ) | pl.s[i].census );
+        pthread_mutex_destroy( &pl.mu );
+        free( t );
+    }
+    free( pl.s );
+    return root;
 }
 
 /** Emit some number of spaces for each level of indentation we're at. */
@@ -619,9 +1831,11 @@ indent( FILE *fp, unsigned int n )
 static int
 jdumpval( FILE *fp, const jvalue *j, unsigned int depth )
 {
+    char num[ fmt_real_size ];
+
     indent( fp, depth );
 
-    switch( j->d ) {
+    switch( jtype( j )) {
     case jnull:
         fputs( "null\n", fp );
         break;
@@ -654,10 +1868,12 @@ jdumpval( FILE *fp, const jvalue *j, unsigned int depth )
             fputs( "NULL number (oops)\n", fp );
         break;
     case jint:
-        fprintf( fp, "integer %lld\n", j->u.i );
+        fmtint( num, j->u.i );
+        fprintf( fp, "integer %s\n", num );
         break;
     case jreal:
-        fprintf( fp, "real %Lg\n", j->u.r );
+        fmtreal( num, jrealval( j ));
+        fprintf( fp, "real %s\n", num );
         break;
     case jarray:
         fputs( "array\n", fp );
@@ -668,8 +1884,8 @@ jdumpval( FILE *fp, const jvalue *j, unsigned int depth )
         fputs( "object\n", fp );
         for( jvalue **jv = j->u.v; *jv; ++jv ) {
             indent( fp, depth+1 );
-            if( (*jv)->n )
-                fputs( (*jv)->n, fp );
+            if( jname( *jv ))
+                fputs( jname( *jv ), fp );
             else
                 fputs( "NULL name (oops)", fp );
             fputc( '\n', fp );
@@ -677,7 +1893,7 @@ jdumpval( FILE *fp, const jvalue *j, unsigned int depth )
         }
         break;
     default:
-        fprintf( fp, "unknown %d (oops)\n", j->d );
+        fprintf( fp, "unknown %d (oops)\n", jtype( j ));
         break;
     }
     return 0;
@@ -2,6 +2,9 @@
 #ifndef jsoncvt_json_h
 #define jsoncvt_json_h
 #pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /** The different types of values in our JSON parser. Unlike the
@@ -18,66 +21,243 @@ enum jtypes {
     jreal,      /**< A JSON number parsed into a long double. */
 };
 
+enum {
+    /** Names in a tree are always aligned to this many bytes, which
+     *  leaves the low bits of their address free to hold the type of
+     *  the value as well; see jvalue.nt. */
+    j_name_align = 16,
+
+    /** The bits of jvalue.nt that hold the type. */
+    j_type_mask = j_name_align - 1,
+
+    /** Set in a census when some element is a jnumber written with a
+     *  decimal point; see jcensus(). */
+    jc_frac = 1 << 15,
+
+    /** How many arrays and objects deep a document may nest before
+     *  the parser gives up on it, unless told otherwise by jrdepth().
+     *  Neither the parser nor anything that walks a tree uses the C
+     *  stack to keep track of how deep it is, so this is only here to
+     *  keep a hostile document from eating all of memory. */
+    j_max_depth = 100000
+};
+
 /** A jvalue represents the different values found in a parse of a
  *  JSON doc. A value can be terminal, like a string or a number, or
- *  it can nest, as with arrays and objects. The value of #d reflects
- *  which part of the union is value. */
+ *  it can nest, as with arrays and objects. The type of a value, from
+ *  jtype(), reflects which part of the union is valid.
+ *
+ *  A big document has millions of these, so they're kept as small as
+ *  we can manage: two words, which is 16 bytes on a 64 bit machine.
+ *  Four of them fit in a cache line. The price of that is that the
+ *  name and type share a word, and that the rare jreal is kept
+ *  outside of the node; use the accessors below rather than poking at
+ *  #nt directly.
+ *
+ *  The root of a tree is also its document. Everything beneath it,
+ *  every jvalue, string, and vector, is allocated from an arena that
+ *  belongs to the document, and lives exactly as long as it does.
+ *  Nothing in the tree is freed on its own; handing the root to
+ *  jdel() releases the whole thing at once. */
 typedef struct jvalue {
 
-    /** Just your basic discriminator, describing which part of the
-     *  union below is active. When this is jtrue, jfalse, or jnull,
-     *  nothing in #u is valid (being unnecessary); all other values
-     *  correspond to one of the #u members as described below. */
-    enum jtypes d;
-
-    /** Some values have a name associated with them; in a JSON
+    /** The name of the value and its type, packed into one word.
+     *
+     *  Some values have a name associated with them; in a JSON
      *  object, for example, the value is assigned to a specific name.
-     *  When #d is jobject, this string should point to the name of a
-     *  member (whose value is in #u). For other values of #d, this
-     *  member should be null. A previous implementation used a
-     *  separate structure for these pairings, but placing the name
-     *  inside each value only costs an extra 4 or 8 bytes yet
-     *  simplifies the tree quite a bit for our client. */
-    char *n;
-
-    /** According to #d above, one or none of these are the active value. */
+     *  When the value is a member of a jobject, jname() returns the
+     *  name of that member (whose value is in #u). For other values,
+     *  it returns a null. A previous implementation used a separate
+     *  structure for these pairings, but placing the name inside each
+     *  value simplifies the tree quite a bit for our client.
+     *
+     *  Names are interned: every member with the same name shares the
+     *  very same copy of it, so two names from the same document are
+     *  equal exactly when their pointers are. Names are never to be
+     *  modified. Since they're all aligned to #j_name_align bytes,
+     *  the low bits of the pointer are always zero, and that's where
+     *  the type lives. Set a name with jsetname(), which takes care of
+     *  all that. */
+    uintptr_t nt;
+
+    /** According to the type, one or none of these are the active
+     *  value. When the type is jtrue, jfalse, or jnull, nothing in
+     *  here is valid (being unnecessary). */
     union {
-        /** When #d is jstring or jnumber, this string is active in
-         *  the union. While obvious for jstring, why would this be
+        /** When the type is jstring or jnumber, this string is active
+         *  in the union. While obvious for jstring, why would this be
          *  used for jnumber? Because, often, there's no need to parse
          *  the number value into something native. While integers are
          *  exact, there's often an unavoidable loss of precision
          *  when converting real numbers. So, we defer it as long as
          *  we can. If the client application actually *wants* a
          *  parsed value, it can convert the string to a native value,
-         *  cache it away in the #i or #r members, and change the
-         *  discriminator to jint or jreal accordingly. This avoids
-         *  unnecessary parsing work and loss of precision, but
-         *  doesn't make it unduly hard for a client to deal with. See
-         *  jupdate() as a function the client can call to do just
-         *  that. */
+         *  cache it away in the #i or #r members, and change the type
+         *  to jint or jreal accordingly. This avoids unnecessary
+         *  parsing work and loss of precision, but doesn't make it
+         *  unduly hard for a client to deal with. See jupdate() as a
+         *  function the client can call to do just that. */
         char *s;
 
-        /** When the discriminator is jint, this integer is active. */
+        /** When the type is jint, this integer is active. */
         long long i;
 
-        /** When the discriminator is jreal, this long double is
-         *  active. */
-        long double r;
+        /** When the type is jreal, this points to the long double
+         *  that is its value. A long double is as big as a node, and
+         *  reals are rare, so they live elsewhere in the document. */
+        long double *r;
 
-        /** When the discriminator is jarray or jobject, this
-         *  zero-terminated vector of pointers to jvalue is active.
-         *  You'll find the ptrvec routines make building these
+        /** When the type is jarray or jobject, this zero-terminated
+         *  vector of pointers to jvalue is active. Just ahead of it
+         *  lies a census of its elements; see jcensus(). Give a
+         *  container its elements with jsetvec(), which takes care of
+         *  that; you'll find the ptrvec routines make collecting them
          *  easy. */
         struct jvalue **v;
     } u;
 } jvalue;
 
+/** Returns the type of \a j, telling which part of jvalue.u is
+ *  valid. */
+static inline enum jtypes
+jtype( const jvalue *j )
+{
+    return (enum jtypes)( j->nt & j_type_mask );
+}
+
+/** Changes the type of \a j to \a t, leaving its name alone. */
+static inline void
+jsettype( jvalue *j, enum jtypes t )
+{
+    j->nt = ( j->nt & ~(uintptr_t)j_type_mask ) | t;
+}
+
+/** Returns the name of \a j, or a null if it hasn't got one. */
+static inline const char *
+jname( const jvalue *j )
+{
+    return (const char *)( j->nt & ~(uintptr_t)j_type_mask );
+}
+
+/** Returns the value of \a j, which must be a jreal. */
+static inline long double
+jrealval( const jvalue *j )
+{
+    return *j->u.r;
+}
+
+/** Returns the census of the elements of \a j, which must be a jarray
+ *  or jobject: for each type in jtypes that any of them has, the bit
+ *  1 << type is set, as is #jc_frac for a jnumber with a decimal
+ *  point. An empty container has a census of zero. The parser takes
+ *  it as it adds each element, and jupdate() keeps it up to date, so
+ *  a client can learn, say, that an array holds nothing but integers
+ *  without looking at any of them. */
+static inline unsigned
+jcensus( const jvalue *j )
+{
+    return ( (const uintptr_t *)j->u.v )[-1];
+}
+
+/** Rather than building a tree, the parser can instead hand each
+ *  piece of the document to a handler as soon as it has been read,
+ *  which lets a client deal with a document of any size in memory
+ *  proportional only to how deeply it nests. See jevents().
+ *
+ *  Each member is a function called for one kind of event, and is
+ *  passed the handler itself; a client keeps whatever state it needs
+ *  in a structure of its own that begins with a jhandler. Should any
+ *  of them return false, the parse stops right there, and jevents()
+ *  returns false as well. */
+typedef struct jhandler {
+    /** An array or object begins; \a t is jarray or jobject. Its
+     *  elements follow, and then a matching call to #end. */
+    bool (*begin)( struct jhandler *, enum jtypes t );
+
+    /** Within an object, the name of the member whose value comes
+     *  next. Names are interned just as they are in a tree, so the
+     *  same name is always the same pointer, and remains valid until
+     *  jevents() returns. */
+    bool (*key)( struct jhandler *, const char *n );
+
+    /** Any value that isn't an array or object; \a t is jnull,
+     *  jtrue, jfalse, jstring, or jnumber. For the last two, \a s
+     *  points to the \a n bytes of the string or number, which are
+     *  only good until this function returns, and are not
+     *  necessarily null terminated. */
+    bool (*scalar)( struct jhandler *, enum jtypes t,
+                    const char *s, size_t n );
+
+    /** The array or object most recently begun, whose type is \a t,
+     *  is complete. */
+    bool (*end)( struct jhandler *, enum jtypes t );
+} jhandler;
+
+/** A reader of a series of JSON documents; see jropen(). */
+typedef struct jreader jreader;
+
+/** Options for building a tree, or'ed together; see jparsef(). */
+enum jpflags {
+    /** Decode each number as it's read, into a jint or a jreal, just
+     *  as jupdate() would, rather than keeping its digits as a
+     *  jnumber. A document that's going to be updated anyway is
+     *  spared making a copy of every number, and reading it twice. */
+    jp_numbers = 1
+};
+
+/** Options for the writers in xml.h and ksh.h, or'ed together. The
+ *  writers keep no state of their own outside of what they're handed,
+ *  so any number of them can run at once, each with its own options,
+ *  on as many threads. */
+enum jwflags {
+    /** In ksh, write objects below the top as associative arrays,
+     *  rather than as compound variables. */
+    jw_assoc = 1,
+
+    /** Write only the documents themselves, leaving out everything
+     *  that would come before the first or after the last. Output
+     *  written this way is meant to be spliced into the middle of
+     *  another conversion's. */
+    jw_part = 2,
+
+    /** The trees handed to the writer stay just as they are until the
+     *  caller next flushes the output, so long strings that need no
+     *  escaping can be written from where they lie in the tree, by
+     *  obref(), rather than copied into the buffer. Only trees are
+     *  written this way; a streaming conversion copies as always. */
+    jw_refs = 4
+};
+
 extern jvalue *jnew();
 extern jvalue *jclear( jvalue * );
+extern jvalue *jsetname( jvalue *, jvalue *, const char * );
+extern jvalue *jsetvec( jvalue *, jvalue *, jvalue *const *, size_t );
 extern void jdel( jvalue * );
 extern jvalue *jparse( FILE *fp );
+extern jvalue *jparse_mem( const char *buf, size_t len );
+extern jvalue *jparsef( FILE *fp, unsigned flags );
+extern jvalue *jparsef_mem( const char *buf, size_t len, unsigned flags );
+extern jvalue *jparsep( FILE *fp, const char *path, unsigned flags );
+extern jvalue *jparsep_mem( const char *buf, size_t len, const char *path,
+                            unsigned flags );
+extern bool jevents( FILE *fp, jhandler *h );
+extern bool jevents_mem( const char *buf, size_t len, jhandler *h );
+extern bool jeventsp( FILE *fp, const char *path, jhandler *h );
+extern bool jeventsp_mem( const char *buf, size_t len, const char *path,
+                          jhandler *h );
+extern jreader *jropen( FILE *fp );
+extern jreader *jropen_mem( const char *buf, size_t len );
+extern void jrline( jreader *r, size_t line );
+extern void jrflags( jreader *r, unsigned flags );
+extern void jrdepth( jreader *r, size_t depth );
+extern void jrpath( jreader *r, const char *path );
+extern size_t jrcount( const char *buf, size_t len );
+extern jvalue *jrnext( jreader *r );
+extern bool jrevents( jreader *r, jhandler *h );
+extern bool jrfailed( const jreader *r );
+extern void jrclose( jreader *r );
 extern jvalue *jupdate(  jvalue * );
+extern jvalue *jupdate_mt( jvalue *, unsigned );
 extern int jdump( FILE *fp, const jvalue *j );
 
 #endif
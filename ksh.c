@@ -1,271 +1,825 @@
 /* See one of the index files for license and other details. */
 #define _POSIX_C_SOURCE 200112L
-#include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "sanity.h"
+#include "arena.h"
+#include "twine.h"
+#include "obuf.h"
+#include "scan.h"
 #include "json.h"
+#include "split.h"
 #include "ksh.h"
 
-/** Originally, we emitted compound variables in out output.
- *  But, there are times when associative arrays make more sense.
- *  Should we do that now? */
-bool usemap = false;
+/** One entry in a kcache: a name, and what safe() makes of it. An
+ *  empty slot has a null #n. */
+typedef struct ksafe {
+    const char *n;              /**< The name, compared by pointer */
+    const char *s;              /**< Its sanitized form */
+} ksafe;
 
-/** Given a nesting depth (zero being the outermost element), emit
- *  some number of spaces that are appropriate for that depth. */
+/** Every record in an array of them carries the same handful of
+ *  member names, and sanitizing each one anew for every record adds
+ *  up. Since the names in a parsed tree are interned, the same name
+ *  is always the same pointer, so we remember the sanitized form of
+ *  each name by its address. A cache lasts only as long as a single
+ *  writer does, during which the names it's shown must stay put (as
+ *  they do in a tree, or from a jreader); names that weren't
+ *  interned merely miss more often. */
+typedef struct kcache {
+    ksafe *slot;                /**< Open addressed hash table */
+    size_t len;                 /**< How many slots are in use */
+    size_t sz;                  /**< How many slots there are */
+    arena a;                    /**< Where the sanitized names live */
+} kcache;
+
+/** One array or object that kvalue() is partway through writing. */
+typedef struct kframe {
+    const jvalue *j;            /**< The array or object */
+    jvalue **v;                 /**< Its next element */
+    unsigned depth;             /**< Its depth */
+} kframe;
+
+/** Where a ksh conversion is going, and how it goes there. Everything
+ *  that writes a value is handed one of these, rather than keeping
+ *  anything in globals, so that any number of conversions can run
+ *  at once. Zero one out before use, and hand it to kfree() after. */
+typedef struct kout {
+    obuf *ob;                   /**< Where the ksh goes */
+    kcache kc;                  /**< Sanitized names */
+    kframe *f;                  /**< The stack kvalue() keeps */
+    size_t sz;                  /**< How many of #f there's room for */
+
+    /** Originally, we emitted compound variables in our output. But,
+     *  there are times when associative arrays make more sense.
+     *  Should we do that now? See #jw_assoc. */
+    bool usemap;
+
+    /** The strings in the trees we write stay put until the output
+     *  is flushed, so they can be written by reference. See
+     *  #jw_refs. */
+    bool refs;
+
+    /** Where the first big array or object goes, if anywhere; see
+     *  splitter. */
+    const splitter *sp;
+} kout;
+
+enum {
+    /** The most bytes that need escaping that emit() handles in one
+     *  go, making room for all of them in the buffer first. */
+    ks_bunch = 256
+};
+
+/** The characters that have an escape of their own in a ksh C-string,
+ *  each mapped to the letter that follows the backslash. Anything
+ *  else that needs escaping is written in hex. */
+static const char kshesc[128] = {
+    [0x07] = 'a', [0x08] = 'b', [0x09] = 't', [0x0a] = 'n',
+    [0x0b] = 'v', [0x0c] = 'f', [0x0d] = 'r', [0x1b] = 'E',
+    ['\''] = '\'', ['\\'] = '\\'
+};
+
+/** Write the string, in ksh C-string format, to the output buffer.
+ *  The runs of characters that need no escaping are found by
+ *  scanksh() and copied out whole; only the rest are handled here.
+ *  Anything outside of ASCII is written as a hex escape, one byte at
+ *  a time, which is how a UTF-8 string makes it through any locale
+ *  unscathed. With \a refs, the runs are written from where they lie
+ *  instead, when they're long enough to be worth it. */
 static void
-indent( FILE *fp, unsigned depth )
+emit( obuf *ob, const char *s, bool refs )
 {
-    while( depth-- )
-        fputs( "  ", fp );
+    static const char hex[] = "0123456789abcdef";
+    size_t n = strlen( s );
+
+    obputs( ob, "$'" );
+    for( ;; ) {
+        size_t k = scanksh( s, n );
+        if( refs )
+            obref( ob, s, k );
+        else
+            obputn( ob, s, k );
+        if( k == n )
+            break;
+        s += k;
+        n -= k;
+
+        /* What needs escaping tends to come in bunches, like all of
+         * the bytes of a UTF-8 character, or a whole string of them,
+         * so we stay here until we come to something that doesn't.
+         * No escape is more than four bytes long, so there's room
+         * enough to write them straight into the buffer. */
+
+        size_t most = n < ks_bunch ? n : ks_bunch;
+        if( 4 * most > ob->sz - ob->len )
+            obgrow( ob, 4 * most );
+
+        const char *from = s, *end = s + most;
+        char *q = ob->p + ob->len;
+        unsigned char c = *s;
+        do {
+            q[0] = '\\';
+            if( c < 128 && kshesc[c] ) {
+                q[1] = kshesc[c];
+                q += 2;
+            } else {
+                q[1] = 'x';
+                q[2] = hex[ c >> 4 ];
+                q[3] = hex[ c & 15 ];
+                q += 4;
+            }
+        } while( ++s < end &&
+                 (( c = *s ) < 32 || c >= 127 || c == '\'' || c == '\\' ));
+        ob->len = q - ob->p;
+        n -= s - from;
+    }
+    obputc( ob, '\'' );
 }
 
-/** Write the string, in ksh C-string format, to the output stream. */
+/** Just like emit(), but with a trailing newline. */
 static void
-emit( FILE *out, const char *s )
-{
-    --s;
-    fputs( "$'", out );
-    while( *++s )
-        if( *s == 0x07 )        fputs( "\\a", out );
-        else if( *s == 0x08 )   fputs( "\\b", out );
-        else if( *s == 0x09 )   fputs( "\\t", out );
-        else if( *s == 0x0a )   fputs( "\\n", out );
-        else if( *s == 0x0b )   fputs( "\\v", out );
-        else if( *s == 0x0c )   fputs( "\\f", out );
-        else if( *s == 0x0d )   fputs( "\\r", out );
-        else if( *s == 0x1b )   fputs( "\\E", out );
-        else if( *s == '\'' )   fputs( "\\'", out );
-        else if( *s == '\\' )   fputs( "\\\\", out );
-        else if( *s < 32 )      fprintf( out, "\\x%02x", *s );
-        else if( *s < 127 )     fputc( *s, out );
-        else                    fprintf( out, "\\x%02x", *s );
-    fputc( '\'', out );
+emitnl( obuf *ob, const char *s, bool refs )
+{
+    emit( ob, s, refs );
+    obputc( ob, '\n' );
 }
 
-/** Just like emit(), but with a trailing newline. */
+/** Returns \a c if it's safe in a variable or member name, or an
+ *  underscore if it isn't; \a first tells whether it would be the
+ *  first character of the name, where digits aren't allowed. */
+static char
+safechar( char c, bool first )
+{
+    if(( c >= 'A' && c <= 'Z' ) || ( c >= 'a' && c <= 'z' )
+       || ( !first && c >= '0' && c <= '9' ))
+        return c;
+    return '_';
+}
+
+/** Make a copy of the string in \a a, safely replacing all problem
+ *  characters with underscore. This is primarily meant for
+ *  non-C-strings, like variable or member names. An empty string
+ *  becomes a lone underscore. */
+static const char *
+sanitize( arena *a, const char *s )
+{
+    size_t n = strlen( s );
+    char *p = ardup( a, n ? s : "_", n ? n : 1 );
+
+    for( char *q = p; *q; ++q )
+        *q = safechar( *q, q == p );
+    return p;
+}
+
+/** Where a name \a n belongs in a cache with \a sz slots. */
+static size_t
+kslot( const char *n, size_t sz )
+{
+    return (size_t)((uintptr_t)n * 2654435761u >> 4 ) & ( sz - 1 );
+}
+
+/** Double the number of slots in \a kc, moving everything over. */
 static void
-emitnl( FILE *out, const char *s )
+kgrow( kcache *kc )
 {
-    emit( out, s );
-    fputc( '\n', out );
+    size_t sz = kc->sz ? kc->sz * 2 : 64;
+    ksafe *slot = emalloc( sz * sizeof( *slot ));
+
+    memset( slot, 0, sz * sizeof( *slot ));
+    for( size_t i = 0; i < kc->sz; ++i )
+        if( kc->slot[i].n ) {
+            size_t k = kslot( kc->slot[i].n, sz );
+            while( slot[k].n )
+                k = ( k + 1 ) & ( sz - 1 );
+            slot[k] = kc->slot[i];
+        }
+
+    free( kc->slot );
+    kc->slot = slot;
+    kc->sz = sz;
 }
 
-/** Write the string, in plain text, to the output stream. Safely
- *  replace all problem characters with underscore. This is primarily
- *  meant for non-C-strings, like variable or member names. */
+/** Write the name \a n, in plain text, to the output stream, by way
+ *  of sanitize(). Names already seen by this writer are found in \a
+ *  kc instead of being sanitized all over again. Without a \a kc, the
+ *  name is simply sanitized on its way out; that's how we write the
+ *  label of each document, which needn't stay put the way the names
+ *  inside a document do. */
 static void
-safe( FILE *out, const char *s )
+safe( obuf *ob, kcache *kc, const char *n )
 {
-    if(( *s >= 'A' && *s <= 'Z' ) || ( *s >= 'a' && *s <= 'z' ))
-        fputc( *s, out );
-    else
-        fputc( '_', out );
+    if( !kc ) {
+        obputc( ob, safechar( *n, true ));
+        if( *n )
+            while( *++n )
+                obputc( ob, safechar( *n, false ));
+        return;
+    }
 
-    while( *++s )
-        if(( *s >= 'A' && *s <= 'Z' ) || ( *s >= 'a' && *s <= 'z' )
-           || ( *s >= '0' && *s <= '9' ))
-            fputc( *s, out );
-        else
-            fputc( '_', out );
+    if( 2 * ( kc->len + 1 ) > kc->sz )
+        kgrow( kc );
+
+    size_t k = kslot( n, kc->sz );
+    while( kc->slot[k].n && kc->slot[k].n != n )
+        k = ( k + 1 ) & ( kc->sz - 1 );
+
+    if( !kc->slot[k].n ) {
+        kc->slot[k] = (ksafe){ .n = n, .s = sanitize( &kc->a, n ) };
+        ++kc->len;
+    }
+    obputs( ob, kc->slot[k].s );
 }
 
-/** Returns true if \a j is a jarray and all of its jvalue.u.v members
- *  are the same type. This is useful for providing more specific type
- *  information to ksh when declaring arrays. The array must have at
- *  least one member in it for this to return true. */
-static bool
-sameval( const jvalue *j )
-{
-    if( !j || j->d != jarray || !j->u.v || !j->u.v[0] )
-        return false;
-
-    enum jtypes jd = j->u.v[0]->d;
-
-    if( jd == jtrue || jd == jfalse ) {
-        for( jvalue **jj = &j->u.v[1]; *jj; ++jj )
-            if( (*jj)->d != jtrue && (*jj)->d != jfalse )
-                return false;
-    } else if( jd == jint || jd == jreal || jd == jnumber ) {
-        for( jvalue **jj = &j->u.v[1]; *jj; ++jj )
-            if( (*jj)->d != jint && (*jj)->d != jreal && (*jj)->d != jnumber )
-                return false;
-    } else
-        for( jvalue **jj = &j->u.v[1]; *jj; ++jj )
-            if( jd != (*jj)->d )
-                return false;
+enum {
+    /** The bits in a census of every kind of integer; see jcensus(). */
+    kk_ints = 1 << jint | 1 << jnumber,
 
-    return true;
+    /** The bits in a census of every kind of number. */
+    kk_nums = kk_ints | 1 << jreal | jc_frac,
+
+    /** The bits in a census of both booleans. */
+    kk_bools = 1 << jtrue | 1 << jfalse
+};
+
+/** Take note of the next element in an array whose census so far is
+ *  \a c, returning the new census. The element's type is \a t, and \a
+ *  s is its string, when \a t is jnumber. This is for arrays that come
+ *  without a census of their own, as they do when streaming; trees
+ *  have one already, from jcensus(). */
+static unsigned
+kkadd( unsigned c, enum jtypes t, const char *s )
+{
+    if( t == jnumber && strchr( s, '.' ))
+        c |= jc_frac;
+    return c | 1u << t;
 }
 
-/** Returns true if \a j is a jarray wherein all of its are integers,
- *  either as jnumber strings without a decimal point or as jint
- *  values. */
-static bool
-allints( const jvalue *j )
-{
-    if( !j->u.v )
-        return false;
-    for( jvalue **jj = j->u.v; *jj; ++jj )
-        switch( (*jj)->d ) {
-        case jnumber:
-            if( strchr( (*jj)->u.s, '.' ))
-                return false;
-            break;
-        case jint:
-            break;
-        default:
-            return false;
-        }
-    return true;
+/** Given the census \a c of an array, return the type that it should
+ *  be declared with: jint when all of its elements are integers
+ *  (either as jnumber strings without a decimal point or as jint
+ *  values), jreal when they're all numbers of some other kind, jtrue
+ *  when they're all booleans, the type they all share if they do, or
+ *  jnull if there's nothing more specific to say. */
+static enum jtypes
+kkresult( unsigned c )
+{
+    if( !( c & ~kk_ints ))
+        return jint;
+    if( !( c & ~kk_nums ))
+        return jreal;
+    if( !( c & ~kk_bools ))
+        return jtrue;
+    for( int t = jnull; t <= jreal; ++t )
+        if( c == 1u << t )
+            return (enum jtypes)t;
+    return jnull;
 }
 
-/** Write out a typeset string for an array of the given type. Since
- *  we're only called from ktypeset(), we can make safe assumptions
- *  about \a j. */
+/** Returns the type that the jarray \a j should be declared with, as
+ *  kkresult() describes. This is useful for providing more specific
+ *  type information to ksh when declaring arrays. */
+static enum jtypes
+karray( const jvalue *j )
+{
+    return j->u.v ? kkresult( jcensus( j )) : jnull;
+}
+
+/** Write out a typeset string for an array whose elements are of type
+ *  \a t, as returned by karray(). */
 void
-ktypesetarray( FILE *fp, const jvalue *j, unsigned depth )
+ktypesetarray( kout *o, enum jtypes t, unsigned depth )
 {
-    if( usemap && depth )
+    obuf *ob = o->ob;
+
+    if( o->usemap && depth )
         return;
-    if( allints( j ))
-        fputs( "integer -a ", fp );
-    else
-        switch( sameval( j ) ? j->u.v[0]->d : jnull ) {
-        case jtrue: case jfalse:
-            fputs( "bool -a ", fp );
-            break;
-        case jnumber: case jreal:
-            fputs( "float -a ", fp );
-            break;
-        case jobject:
-            fputs( "compound -a ", fp );
-            break;
-        default:
-            fputs( "typeset -a ", fp );
-            break;
+    switch( t ) {
+    case jint:
+        obputs( ob, "integer -a " );
+        break;
+    case jtrue: case jfalse:
+        obputs( ob, "bool -a " );
+        break;
+    case jnumber: case jreal:
+        obputs( ob, "float -a " );
+        break;
+    case jobject:
+        obputs( ob, "compound -a " );
+        break;
+    default:
+        obputs( ob, "typeset -a " );
+        break;
     }
 }
 
 /** Write out a typeset string that introduces the next word to be
- *  printed as a variable or compound member of the right type.
- *  Nothing is printed for strings and the like. */
+ *  printed as a variable or compound member of type \a t. When \a t
+ *  is jnumber, \a s is its string; when it's jarray, \a a is the type
+ *  of its elements, as from karray(). Nothing is printed for strings
+ *  and the like. */
 void
-ktypeset( FILE *fp, const jvalue *j, unsigned depth )
+ktypeset( kout *o, enum jtypes t, const char *s, enum jtypes a,
+          unsigned depth )
 {
-    switch( j ? j->d : jnull ) {
+    obuf *ob = o->ob;
+
+    switch( t ) {
     case jtrue: case jfalse:
-	if( !usemap || !depth )
-            fputs( "bool ", fp );
+	if( !o->usemap || !depth )
+            obputs( ob, "bool " );
         break;
     case jint:
-	if( !usemap || !depth )
-            fputs( "integer ", fp );
+	if( !o->usemap || !depth )
+            obputs( ob, "integer " );
         break;
     case jreal:
-	if( !usemap || !depth )
-            fputs( "float ", fp );
+	if( !o->usemap || !depth )
+            obputs( ob, "float " );
         break;
     case jnumber:
-	if( !usemap || !depth )
-            fputs(( j->u.s && strchr( j->u.s, '.' )) ? "float " : "integer ", fp );
+	if( !o->usemap || !depth )
+            obputs( ob, ( s && strchr( s, '.' )) ? "float " : "integer " );
         break;
     case jobject:
-	if( !usemap )
-            fputs( "compound ", fp );
+	if( !o->usemap )
+            obputs( ob, "compound " );
 	else if( !depth )
-	    fputs( "typeset -A ", fp );
+	    obputs( ob, "typeset -A " );
         break;
     case jarray:
-        ktypesetarray( fp, j, depth );
+        ktypesetarray( o, a, depth );
         break;
     default:
         break;
     }
 }
 
-/** Write the name of a jvalue out, with any necessary typeset
- *  information preceding it. An '=' is printed at the end. If \a j
- *  does not have a name, a fake name is generated on the fly. */
+/** Write the name \a n of a value out, with any necessary typeset
+ *  information preceding it; \a t, \a s, and \a a are as ktypeset()
+ *  describes. An '=' is printed at the end. If there is no name, a
+ *  fake name is generated on the fly. */
 void
-kname( FILE *fp, const jvalue *j, unsigned depth )
+kname( kout *o, enum jtypes t, const char *s, enum jtypes a,
+       const char *n, unsigned depth )
 {
-    ktypeset( fp, j, depth );
+    obuf *ob = o->ob;
+
+    ktypeset( o, t, s, a, depth );
 
-    if( !j || !j->n ) {
-	if( usemap && depth )
-	    fputs( "[foobar]=", fp );
+    if( !n ) {
+	if( o->usemap && depth )
+	    obputs( ob, "[foobar]=" );
 	else
-            fputs( "foobar=", fp );
-    } else if( usemap && depth ) {
-	fputc( '[', fp );
-	emit( fp, j->n );
-	fputs( "]=", fp );
+            obputs( ob, "foobar=" );
+    } else if( o->usemap && depth ) {
+	obputc( ob, '[' );
+	emit( ob, n, false );
+	obputs( ob, "]=" );
     } else {
-        safe( fp, j->n );
-        fputc( '=', fp );
+        safe( ob, depth ? &o->kc : 0, n );
+        obputc( ob, '=' );
     }
 }
 
-/** Writes the JSON value out to the supplied file descriptor. When \a
- *  nested is true and we encounter a jarray, we understand that we
- *  don't need to print a leading typeset or name, and skip right to
- *  the value; along those lines, when we encounter a jarray, we know
- *  to set nested true for the recursion, and set it false on jobject
- *  recursion. All of these are */
-bool
-kvalue( FILE *fp, const jvalue *j, bool nested, unsigned depth )
+/** Write out the value of a terminal of type \a t, whose string (when
+ *  it has one) is \a s, followed by a newline. With \a refs, a string
+ *  can be written by reference, as emit() describes. */
+static void
+kscalar( obuf *ob, enum jtypes t, const char *s, bool refs )
 {
-    indent( fp, depth );
-
-    if( !nested )
-        kname( fp, j, depth );
-
-    switch( j->d ) {
-    case jnull:
-        fputc( '\n', fp );
-        break;
+    switch( t ) {
     case jtrue:
-        fputs( "true\n", fp );
+        obputs( ob, "true\n" );
         break;
     case jfalse:
-        fputs( "false\n", fp );
+        obputs( ob, "false\n" );
         break;
     case jstring:
-        emitnl( fp, j->u.s );
+        emitnl( ob, s, refs );
         break;
     case jnumber:
-        fputs( j->u.s, fp );
-        fputc( '\n', fp );
-        break;
-    case jint:
-        fprintf( fp, "%llu\n", j->u.i );
+        obputs( ob, s );
+        obputc( ob, '\n' );
         break;
-    case jreal:
-        fprintf( fp, "%Lg\n", j->u.r );
-        break;
-    case jobject:
-        fputs( "(\n", fp );
-        for( jvalue **jj = j->u.v; *jj; ++jj )
-            kvalue( fp, *jj, false, depth+1 );
-        indent( fp, depth );
-        fputs( ")\n", fp );
-        break;
-    case jarray:
-        fputs( "(\n", fp );
-        for( jvalue **jj = j->u.v; *jj; ++jj )
-            kvalue( fp, *jj, true, depth+1 );
-        indent( fp, depth );
-        fputs( ")\n", fp );
+    default:
+        obputc( ob, '\n' );
         break;
     }
+}
+
+/** Release everything \a o has, but not \a o itself. */
+static void
+kfree( kout *o )
+{
+    free( o->kc.slot );
+    arclear( &o->kc.a );
+    free( o->f );
+}
+
+/** Writes the JSON value out to the supplied output buffer, named
+ *  \a n. When \a nested is true and we encounter a jarray, we
+ *  understand that we don't need to print a leading typeset or name,
+ *  and skip right to the value; along those lines, the elements of a
+ *  jarray are all nested, and the members of a jobject are not.
+ *
+ *  Rather than calling ourselves for each element, we push the
+ *  container onto the stack in \a o and carry on with its first
+ *  element; once a value is written, the next one is the next element
+ *  of the container on top of the stack, and a container with none
+ *  left is closed and popped. */
+bool
+kvalue( kout *o, const jvalue *j, const char *n, bool nested,
+        unsigned depth )
+{
+    obuf *ob = o->ob;
+    size_t len = 0;
+
+    for( ;; ) {
+        enum jtypes t = jtype( j );
+
+        obindent( ob, depth );
+
+        if( !nested )
+            kname( o, t, j->u.s, t == jarray ? karray( j ) : jnull,
+                   n, depth );
+
+        switch( t ) {
+        case jint:
+            obputint( ob, j->u.i );
+            obputc( ob, '\n' );
+            break;
+        case jreal:
+            obputreal( ob, jrealval( j ));
+            obputc( ob, '\n' );
+            break;
+        case jobject: case jarray:
+            obputs( ob, "(\n" );
+            if( o->sp && spwrite( o->sp, ob, j, depth+1 )) {
+                obindent( ob, depth );
+                obputs( ob, ")\n" );
+                break;
+            }
+            if( len == o->sz ) {
+                o->sz = o->sz ? 2 * o->sz : 16;
+                o->f = erealloc( o->f, o->sz * sizeof( *o->f ));
+            }
+            o->f[ len++ ] = (kframe){ .j = j, .v = j->u.v, .depth = depth };
+            break;
+        default:
+            kscalar( ob, t, j->u.s, o->refs );
+            break;
+        }
+
+        /* On to the next element of the innermost container, closing
+         * any that have run out. */
+
+        while( len && !*o->f[ len - 1 ].v ) {
+            obindent( ob, o->f[ --len ].depth );
+            obputs( ob, ")\n" );
+        }
+        if( !len )
+            return true;
+
+        kframe *f = &o->f[ len - 1 ];
+        j = *f->v++;
+        nested = jtype( f->j ) == jarray;
+        n = nested ? 0 : jname( j );
+        depth = f->depth + 1;
+    }
+}
+
+/** Write the tree \a j out to \a ob as ksh, named by its own name.
+ *  The \a flags that matter here are #jw_assoc and #jw_refs. */
+bool
+writeksh( obuf *ob, const jvalue *j, unsigned flags )
+{
+    return writeksh_mt( ob, j, flags, 1 );
+}
+
+/** Render the \a n elements at \a v, which are in a container of type
+ *  \a t, at \a depth; this is how a splitter renders a slice. Each
+ *  slice has a kout, and so a cache of names, of its own. */
+static void
+kslice( obuf *ob, unsigned flags, enum jtypes t, jvalue *const *v,
+        size_t n, unsigned depth )
+{
+    kout o = (kout){ .ob = ob, .usemap = flags & jw_assoc,
+                     .refs = flags & jw_refs };
+
+    for( size_t i = 0; i < n; ++i )
+        kvalue( &o, v[i], t == jobject ? jname( v[i] ) : 0, t == jarray,
+                depth );
+    kfree( &o );
+}
+
+/** Just like writeksh(), but with up to \a threads threads rendering
+ *  the elements of a big array or object at once; see splitter. The
+ *  output is the same either way. */
+bool
+writeksh_mt( obuf *ob, const jvalue *j, unsigned flags, unsigned threads )
+{
+    splitter sp = (splitter){
+        .render = kslice, .flags = flags, .threads = threads
+    };
+    kout o = (kout){ .ob = ob, .usemap = flags & jw_assoc,
+                     .refs = flags & jw_refs, .sp = &sp };
+    bool ok = kvalue( &o, j, jname( j ), false, 0 );
+
+    kfree( &o );
+    return ok;
+}
+
+enum {
+    /** How much a kstream may hold back while it looks ahead to the end
+     *  of an array, counting both the events and the strings that
+     *  come with them. */
+    ks_lookahead = 1024 * 1024
+};
+
+/** The kinds of events that a kstream can hold back. */
+enum kevents {
+    ke_begin,                   /**< An array or object begins */
+    ke_key,                     /**< The name of the next value */
+    ke_scalar,                  /**< A terminal value */
+    ke_end                      /**< An array or object ends */
+};
+
+/** One event held back by a kstream. */
+typedef struct kevent {
+    enum kevents e;             /**< What happened */
+    enum jtypes t;              /**< The type of value, if any */
+    const char *s;              /**< The name, or the terminal's string */
+} kevent;
+
+/** The state of a ksh conversion that runs straight off the events
+ *  coming out of the parser, rather than a tree. See kshopen().
+ *
+ *  Almost everything can be written the moment it arrives. The one
+ *  exception is an array that has to be declared with a type, like
+ *  "integer -a", which depends on every one of its elements; we can't
+ *  write a byte of it until we've seen them all. So, we hold back the
+ *  events from the start of such an array until it ends, and then
+ *  replay them, looking ahead in what we held back to declare that
+ *  array, and any others inside it, just as writeksh() would. Should
+ *  an array prove too big to hold back (see #ks_lookahead), we give
+ *  up waiting; it and any other arrays still open in what we held
+ *  back are declared with a plain "typeset -a", and the rest of it
+ *  is written as it arrives. That's the only way our output ever
+ *  differs from what writeksh() writes for the same document. */
+typedef struct kstream {
+    jhandler h;                 /**< Our handler; must come first */
+    kout o;                     /**< Where the ksh goes, and how */
+    const char *name;           /**< The name of the next value */
+    twine open;                 /**< The types of the open containers */
+    twine tw;                   /**< Scratch space for terminal values */
+    kevent *ev;                 /**< The events being held back */
+    size_t len;                 /**< How many of #ev are in use */
+    size_t sz;                  /**< How many of #ev there are */
+    size_t held;                /**< How many bytes are being held back */
+    size_t hdepth;              /**< Nesting in what's held, if any */
+    arena a;                    /**< Strings of the events held back */
+} kstream;
+
+/** Returns true if the next value written by \a k would be nested in
+ *  an array, and thus needs no name. */
+static bool
+ksnested( const kstream *k )
+{
+    return k->open.len && k->open.p[ k->open.len - 1 ] == jarray;
+}
+
+/** Returns true if an array written next by \a k would be declared
+ *  with a type that depends on its elements. */
+static bool
+kslookahead( const kstream *k )
+{
+    return !ksnested( k ) && !( k->o.usemap && k->open.len );
+}
+
+/** Write the start of an array or object of type \a t, whose elements
+ *  are of type \a a (as from karray()). */
+static void
+ksputbegin( kstream *k, enum jtypes t, enum jtypes a )
+{
+    obindent( k->o.ob, k->open.len );
+    if( !ksnested( k ))
+        kname( &k->o, t, 0, a, k->name, k->open.len );
+    obputs( k->o.ob, "(\n" );
+    twaddc( &k->open, t );
+    k->name = 0;
+}
+
+/** Write a terminal value of type \a t, whose string is \a s. */
+static void
+ksputscalar( kstream *k, enum jtypes t, const char *s )
+{
+    obindent( k->o.ob, k->open.len );
+    if( !ksnested( k ))
+        kname( &k->o, t, s, jnull, k->name, k->open.len );
+    kscalar( k->o.ob, t, s, false );
+    k->name = 0;
+}
+
+/** Write the end of the innermost array or object. */
+static void
+ksputend( kstream *k )
+{
+    k->open.p[ --k->open.len ] = 0;
+    obindent( k->o.ob, k->open.len );
+    obputs( k->o.ob, ")\n" );
+}
+
+/** Given the array that begins with the held back event at \a i,
+ *  return the type it should be declared with, as karray() would; or
+ *  jnull, if its end isn't among the events held back. */
+static enum jtypes
+ksarray( const kstream *k, size_t i )
+{
+    unsigned c = 0;
+    size_t depth = 0;
+
+    while( ++i < k->len )
+        switch( k->ev[i].e ) {
+        case ke_begin:
+            if( !depth++ )
+                c |= 1u << k->ev[i].t;
+            break;
+        case ke_scalar:
+            if( !depth )
+                c = kkadd( c, k->ev[i].t, k->ev[i].s );
+            break;
+        case ke_end:
+            if( !depth-- )
+                return kkresult( c );
+            break;
+        default:
+            break;
+        }
+    return jnull;
+}
 
+/** Write out every event held back by \a k, and stop holding back. */
+static void
+ksreplay( kstream *k )
+{
+    k->hdepth = 0;
+    for( size_t i = 0; i < k->len; ++i )
+        switch( k->ev[i].e ) {
+        case ke_begin:
+            ksputbegin( k, k->ev[i].t,
+                        k->ev[i].t == jarray && kslookahead( k )
+                        ? ksarray( k, i ) : jnull );
+            break;
+        case ke_key:
+            k->name = k->ev[i].s;
+            break;
+        case ke_scalar:
+            ksputscalar( k, k->ev[i].t, k->ev[i].s );
+            break;
+        case ke_end:
+            ksputend( k );
+            break;
+        }
+
+    k->len = k->held = 0;
+    arreset( &k->a );
+}
+
+/** Hold back one more event at \a k, which began holding back at the
+ *  start of an array. Once that array ends, or we've held back all
+ *  that we're willing to, everything is written out. */
+static void
+kshold( kstream *k, enum kevents e, enum jtypes t, const char *s )
+{
+    if( k->len == k->sz ) {
+        k->sz = k->sz ? k->sz * 2 : 256;
+        k->ev = erealloc( k->ev, k->sz * sizeof( *k->ev ));
+    }
+    k->ev[ k->len++ ] = (kevent){ .e = e, .t = t, .s = s };
+    k->held += sizeof( *k->ev ) + ( e == ke_scalar && s ? strlen( s ) : 0 );
+
+    if( e == ke_begin )
+        ++k->hdepth;
+    else if( e == ke_end )
+        --k->hdepth;
+    if( !k->hdepth || k->held > ks_lookahead )
+        ksreplay( k );
+}
+
+/** A jhandler function, for the start of an array or object. */
+static bool
+ksbegin( jhandler *h, enum jtypes t )
+{
+    kstream *k = (kstream *)h;
+
+    if( k->hdepth || ( t == jarray && kslookahead( k )))
+        kshold( k, ke_begin, t, 0 );
+    else
+        ksputbegin( k, t, jnull );
+    return true;
+}
+
+/** A jhandler function, for the name of the next value. */
+static bool
+kskey( jhandler *h, const char *n )
+{
+    kstream *k = (kstream *)h;
+
+    if( k->hdepth )
+        kshold( k, ke_key, jnull, n );
+    else
+        k->name = n;
+    return true;
+}
+
+/** A jhandler function, for a terminal value. Strings are made into C
+ *  strings first; much as when writing from a tree, anything after a
+ *  null inside the string goes unwritten. */
+static bool
+ksscalar( jhandler *h, enum jtypes t, const char *s, size_t n )
+{
+    kstream *k = (kstream *)h;
+
+    if( s ) {
+        k->tw.len = 0;
+        s = twaddn( &k->tw, s, n )->p;
+    }
+    if( k->hdepth )
+        kshold( k, ke_scalar, t, s ? ardup( &k->a, s, n ) : 0 );
+    else
+        ksputscalar( k, t, s );
+    return true;
+}
+
+/** A jhandler function, for the end of an array or object. */
+static bool
+ksend( jhandler *h, enum jtypes t )
+{
+    kstream *k = (kstream *)h;
+
+    if( k->hdepth )
+        kshold( k, ke_end, t, 0 );
+    else
+        ksputend( k );
     return true;
 }
 
+/** Begin converting JSON to ksh on \a ob while it is being parsed,
+ *  rather than afterwards. The handler returned is fed to jevents()
+ *  or jrevents(), which drive the conversion. The top value of each
+ *  document is named by a call to the handler's key function just
+ *  before it. See kstream for how the result compares with
+ *  writeksh().
+ *
+ *  There can be any number of documents, one after another, and trees
+ *  can be mixed right in with them; see kshwrite(). Once all of them
+ *  are through, hand the handler to kshclose(). The \a flags are
+ *  those of jwflags; ksh has nothing to write around the documents,
+ *  so #jw_part makes no difference. */
+jhandler *
+kshopen( obuf *ob, unsigned flags )
+{
+    kstream *k = emalloc( sizeof( *k ));
+
+    *k = (kstream){
+        .h = { .begin = ksbegin, .key = kskey, .scalar = ksscalar,
+               .end = ksend },
+        .o = { .ob = ob, .usemap = flags & jw_assoc,
+               .refs = flags & jw_refs }
+    };
+    return &k->h;
+}
+
+/** Write the tree \a j as the next document in the conversion begun
+ *  by kshopen(), exactly as writeksh() would. It's named by the
+ *  handler's key function, if that was called, or else by its own
+ *  name. */
 bool
-writeksh( FILE *fp, const jvalue *j )
+kshwrite( jhandler *h, const jvalue *j )
 {
-    return kvalue( fp, j, false, 0 );
+    kstream *k = (kstream *)h;
+    bool ok = kvalue( &k->o, j, k->name ? k->name : jname( j ), false, 0 );
+
+    k->name = 0;
+    return ok;
+}
+
+/** Finish a conversion begun by kshopen(), releasing \a h. Returns
+ *  false if the last document was never completed. */
+bool
+kshclose( jhandler *h )
+{
+    kstream *k = (kstream *)h;
+    bool ok = !k->open.len && !k->hdepth;
+
+    kfree( &k->o );
+    twclear( &k->open );
+    twclear( &k->tw );
+    free( k->ev );
+    arclear( &k->a );
+    free( k );
+    return ok;
 }
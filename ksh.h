@@ -2,12 +2,14 @@
 #ifndef jsoncvt_ksh_h
 #define jsoncvt_ksh_h
 #pragma once
-#include <stdio.h>
 #include "json.h"
+#include "obuf.h"
 
-extern bool usemap;	/* use map instead of associative array in output */
-
-extern bool writeksh( FILE *, const jvalue * );
+extern bool writeksh( obuf *, const jvalue *, unsigned );
+extern bool writeksh_mt( obuf *, const jvalue *, unsigned, unsigned );
+extern jhandler *kshopen( obuf *, unsigned );
+extern bool kshwrite( jhandler *, const jvalue * );
+extern bool kshclose( jhandler * );
 
 #endif
 
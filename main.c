@@ -1,36 +1,688 @@
 /* See one of the index files for license and other details. */
 #define _POSIX_C_SOURCE 200112L
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include "sanity.h"
+#include "twine.h"
+#include "obuf.h"
+#include "scan.h"
 #include "json.h"
 #include "xml.h"
 #include "ksh.h"
+#include "stats.h"
 
-const char usage[]="usage: jsoncvt [-Akx] [label]\n"
+const char usage[]="usage: jsoncvt [-AknSsx] [-j threads] [-m member] [-p path] [label]\n"
     "example: jsoncvt -x mydata <foo.json >foo.xml\n";
 
+/** A JSON document that has been mapped into memory, or, failing
+ *  that, read into it. */
+typedef struct mapping {
+    void *m;                    /**< The mapping itself */
+    size_t sz;                  /**< The size of the mapping */
+    char *buf;                  /**< Or, our own copy */
+    const char *p;              /**< The document, within #m or #buf */
+    size_t len;                 /**< The size of the document */
+} mapping;
+
+/** When \a fp is a regular file, map it into memory and fill in \a
+ *  mp, returning true; the document begins at the current offset of
+ *  \a fp, as it would with read(2). Pipes, terminals, and anything
+ *  else that can't be mapped return false, and have to be streamed
+ *  instead. */
+static bool
+mapin( FILE *fp, mapping *mp )
+{
+    int fd = fileno( fp );
+    struct stat st;
+    off_t off;
+
+    if( fstat( fd, &st ) || !S_ISREG( st.st_mode ) || st.st_size <= 0
+        || ( off = lseek( fd, 0, SEEK_CUR )) < 0 || off > st.st_size )
+        return false;
+
+    void *m = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( m == MAP_FAILED )
+        return false;
+
+    posix_madvise( m, st.st_size, POSIX_MADV_SEQUENTIAL );
+    *mp = (mapping){ .m = m, .sz = st.st_size,
+                     .p = (const char *)m + off, .len = st.st_size - off };
+    return true;
+}
+
+/** Read everything waiting on \a fp into memory of our own, and fill
+ *  in \a mp, just as mapin() would have. A read that fails is treated
+ *  as the end of the input, just as the parser treats it. */
+static void
+slurp( FILE *fp, mapping *mp )
+{
+    int fd = fileno( fp );
+    size_t len = 0, sz = 64 * 1024;
+    char *buf = emalloc( sz );
+
+    for( ;; ) {
+        if( len == sz )
+            buf = erealloc( buf, sz *= 2 );
+
+        ssize_t n = read( fd, buf + len, sz - len );
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 )
+            err( "cannot read JSON data: %s", strerror( errno ));
+        if( n <= 0 )
+            break;
+        len += n;
+    }
+    *mp = (mapping){ .buf = buf, .p = buf, .len = len };
+}
+
+/** Get the JSON data waiting on \a fp into memory, filling in \a mp,
+ *  and return true; or, return false if it has to be streamed. It's
+ *  mapped, if it can be. Otherwise, when \a whole is true, it's read
+ *  in; that's how -S knows how big it was, and times the parse apart
+ *  from waiting for the input. */
+static bool
+getin( FILE *fp, mapping *mp, bool whole )
+{
+    if( mapin( fp, mp ))
+        return true;
+    if( whole )
+        slurp( fp, mp );
+    return whole;
+}
+
+/** Release the memory that getin() filled \a mp in with. */
+static void
+release( mapping *mp )
+{
+    if( mp->buf )
+        free( mp->buf );
+    else
+        munmap( mp->m, mp->sz );
+}
+
+/** Parse the JSON document waiting on \a fp, or just the part of it
+ *  at \a path, if that's given. When \a fp is a regular file, we map
+ *  it into memory and let the parser run straight over the mapping,
+ *  leaving readahead to the kernel and skipping the copy into a buffer
+ *  altogether. Anything else is simply streamed through jparsep(),
+ *  unless we're keeping statistics in \a st. */
+static jvalue *
+parse( FILE *fp, const char *path, stats *st )
+{
+    mapping mp;
+
+    if( !getin( fp, &mp, st ))
+        return jparsep( fp, path, 0 );
+
+    double t = st ? stnow() : 0;
+    jvalue *j = jparsep_mem( mp.p, mp.len, path, 0 );
+    if( st ) {
+        st->parse = stnow() - t;
+        st->in = mp.len;
+    }
+    release( &mp );
+    return j;
+}
+
+/** Just like parse(), but the document is handed to \a h a piece at a
+ *  time, rather than built into a tree. */
+static bool
+events( FILE *fp, const char *path, jhandler *h, stats *st )
+{
+    mapping mp;
+
+    if( !getin( fp, &mp, st ))
+        return jeventsp( fp, path, h );
+
+    bool ok = jeventsp_mem( mp.p, mp.len, path, h );
+    if( st )
+        st->in = mp.len;
+    release( &mp );
+    return ok;
+}
+
+/** Everything that says how to convert a series of documents. */
+typedef struct how {
+    jhandler *(*opener)( obuf *, unsigned ); /**< Begins the output */
+    bool (*writer)( jhandler *, const jvalue * ); /**< Writes a tree */
+    bool (*closer)( jhandler * );   /**< Finishes the output */
+    unsigned flags;             /**< The jwflags for the writers */
+    bool streaming;             /**< Never build a tree at all */
+    const char *label;          /**< What documents are named after */
+    const char *member;         /**< Or, the member that names them */
+    const char *path;           /**< The part of each to convert */
+} how;
+
+/** Returns the name for the \a n'th document in a series, built in
+ *  \a tw. When \a member is given and the document \a j is an object
+ *  with a member of that name holding a string or a number, that's
+ *  the name; otherwise, it's \a label followed by \a n. */
+static const char *
+recname( twine *tw, const char *label, const char *member,
+         const jvalue *j, unsigned long long n )
+{
+    if( member && j && jtype( j ) == jobject )
+        for( jvalue **jj = j->u.v; *jj; ++jj )
+            if(( jtype( *jj ) == jstring || jtype( *jj ) == jnumber )
+               && !strcmp( jname( *jj ), member ))
+                return (*jj)->u.s;
+
+    char num[ 24 ];
+    snprintf( num, sizeof( num ), "%llu", n );
+    tw->len = 0;
+    twaddz( twaddz( tw, label ), num );
+    return tw->p;
+}
+
+/** Convert every document left at \a r, handing each to \a h in turn,
+ *  the first of them being the \a n'th in the series. Each is named
+ *  as recname() describes. Unless we're streaming, each document is
+ *  parsed into a tree and handed to the writer; otherwise, each is
+ *  streamed straight to \a h. Returns false if a document was bad, in
+ *  which case the ones before it have already been converted. Given
+ *  \a st, every document is counted there as well, and the parsing
+ *  and writing of each tree timed. */
+static bool
+records( jreader *r, jhandler *h, const how *hw, unsigned long long n,
+         stats *st )
+{
+    twine tw = (twine){ 0 };
+    sttap tp;
+    jhandler *in = st && hw->streaming ? sttapinit( &tp, st, h ) : h;
+
+    for( ;; ++n )
+        if( !hw->streaming ) {
+            double t = st ? stnow() : 0;
+            jvalue *j = jrnext( r );
+            if( st )
+                st->parse += stnow() - t;
+            if( !j )
+                break;
+            h->key( h, recname( &tw, hw->label, hw->member, j, n ));
+            if( st ) {
+                stsurvey( st, j );
+                t = stnow();
+            }
+            (*hw->writer)( h, j );
+            if( st )
+                st->write += stnow() - t;
+        } else {
+            h->key( h, recname( &tw, hw->label, 0, 0, n ));
+            if( !jrevents( r, in ))
+                break;
+        }
+
+    twclear( &tw );
+    return !jrfailed( r );
+}
+
+/** Convert every one of a series of JSON documents waiting on \a fp
+ *  (NDJSON, for example), handing each to \a h in turn, as records()
+ *  describes, counting them in \a st if it's given. */
+static bool
+series( FILE *fp, jhandler *h, const how *hw, stats *st )
+{
+    mapping mp;
+    bool mapped = getin( fp, &mp, st );
+    jreader *r = mapped ? jropen_mem( mp.p, mp.len ) : jropen( fp );
+    jrpath( r, hw->path );
+    bool ok = records( r, h, hw, 1, st );
+
+    jrclose( r );
+    if( mapped ) {
+        if( st )
+            st->in = mp.len;
+        release( &mp );
+    }
+    return ok;
+}
+
+enum {
+    /** With -j, the input is cut into pieces of about this many bytes,
+     *  each ending at a newline, and each converted on its own. Big
+     *  enough that the threads aren't forever coming back for more,
+     *  small enough that even a modest input keeps them all busy. */
+    mj_piece = 1024 * 1024,
+
+    /** How many pieces each thread may have in hand, converted or
+     *  not, beyond the one being written out. This is what bounds our
+     *  memory, should the output be slower than the threads. */
+    mj_ahead = 4,
+
+    /** The most threads we'll run with -j. */
+    mj_max = 1024
+};
+
+/** What has become of one piece of the input, in order. */
+enum pstates {
+    ps_free,                    /**< The slot is empty */
+    ps_taken,                   /**< Its documents are being counted */
+    ps_counted,                 /**< Counted, but not yet placed */
+    ps_placed,                  /**< Its first document is known */
+    ps_done                     /**< Converted, and ready to write */
+};
+
+/** One piece of the input, and the output it becomes. */
+typedef struct piece {
+    size_t k;                   /**< Which piece this is, from zero */
+    enum pstates state;         /**< How far along it is */
+    char *buf;                  /**< Our own copy, when not mapped */
+    const char *p;              /**< The piece itself */
+    size_t len;                 /**< Its size */
+    size_t docs;                /**< How many documents are in it */
+    size_t lines;               /**< How many newlines */
+    unsigned long long n;       /**< The ordinal of its first document */
+    size_t line;                /**< The line its first byte is on */
+    obuf out;                   /**< What it was converted to */
+    stats st;                   /**< What was in it, for -S */
+    bool ok;                    /**< Every document in it was good */
+    bool closed;                /**< Its output wasn't left half done */
+} piece;
+
+/** The state shared by the threads converting a series with -j.
+ *
+ *  The input is cut into pieces at newlines, so that (with one
+ *  document per line) each piece holds some number of whole
+ *  documents, and any thread can convert any piece. The only thing
+ *  a piece needs to know about the ones before it is how many
+ *  documents they held, so that it can name its own; the same goes
+ *  for lines, which error messages need. So, a thread first counts
+ *  what's in its piece with jrcount(), which is quick, and then waits
+ *  for the pieces before it to be counted as well. Whichever thread
+ *  finishes counting a piece places as many pieces as it can, from
+ *  the first one not yet placed onward.
+ *
+ *  Each piece is converted into memory of its own. Meanwhile, the
+ *  main thread writes out the pieces in order, each as soon as it's
+ *  done. Pieces live in a ring of slots, so a thread can only take
+ *  a new piece once the piece that last used its slot has been
+ *  written out; taking pieces is done under #rmu, reading from the
+ *  input as needed, and everything else under #mu. */
+typedef struct pool {
+    pthread_mutex_t rmu;        /**< Held while taking a piece */
+    pthread_mutex_t mu;         /**< Held for everything else */
+    pthread_cond_t cv;          /**< Something has changed */
+    const how *hw;              /**< What to do with the documents */
+    stats *st;                  /**< What to add each piece's stats to */
+    int fd;                     /**< The input, when not mapped */
+    const char *p;              /**< Or, the mapped input */
+    size_t len;                 /**< The size of #p */
+    size_t at;                  /**< How much of #p has been taken */
+    char *rest;                 /**< Input read from #fd past a newline */
+    size_t nrest;               /**< The size of #rest */
+    bool eof;                   /**< No more input to be had */
+    piece *pc;                  /**< The ring of slots */
+    size_t npc;                 /**< The number of slots */
+    size_t taken;               /**< How many pieces have been taken */
+    bool last;                  /**< And no more are coming */
+    size_t placed;              /**< How many pieces have been placed */
+    unsigned long long n;       /**< The first document of the next */
+    size_t line;                /**< The first line of the next */
+    bool stop;                  /**< Don't bother taking any more */
+} pool;
+
+/** Returns the number of newlines in the \a n bytes at \a p. */
+static size_t
+newlines( const char *p, size_t n )
+{
+    size_t nl = 0;
+    const char *end = p + n;
+
+    while(( p = memchr( p, '\n', end - p ))) {
+        ++nl;
+        ++p;
+    }
+    return nl;
+}
+
+/** Read the next piece of the input at \a pl into \a pc: whatever was
+ *  left over from the last piece, and then at least #mj_piece more
+ *  bytes, or as many as it takes to find a newline. Whatever follows
+ *  the last newline is left over for the next piece. Returns false
+ *  once the input is exhausted. */
+static bool
+readpiece( pool *pl, piece *pc )
+{
+    size_t len = pl->nrest, sz = len + mj_piece, cut = 0;
+    char *buf = emalloc( sz );
+
+    if( len )
+        memcpy( buf, pl->rest, len );
+    while( !pl->eof && !( cut && len >= mj_piece )) {
+        if( len == sz )
+            buf = erealloc( buf, sz *= 2 );
+
+        ssize_t n = read( pl->fd, buf + len, sz - len );
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 )
+            err( "cannot read JSON data: %s", strerror( errno ));
+        if( n <= 0 ) {
+            pl->eof = true;
+            break;
+        }
+
+        for( size_t i = len + n; i > len; --i )
+            if( buf[ i - 1 ] == '\n' ) {
+                cut = i;
+                break;
+            }
+        len += n;
+    }
+    if( pl->eof )
+        cut = len;
+
+    pl->nrest = len - cut;
+    pl->rest = erealloc( pl->rest, pl->nrest + 1 );
+    memcpy( pl->rest, buf + cut, pl->nrest );
+
+    if( !cut ) {
+        free( buf );
+        return false;
+    }
+    *pc = (piece){ .buf = buf, .p = buf, .len = cut };
+    return true;
+}
+
+/** Just like readpiece(), but the input at \a pl is mapped, and the
+ *  piece is simply the right stretch of the mapping. */
+static bool
+mappiece( pool *pl, piece *pc )
+{
+    if( pl->at >= pl->len )
+        return false;
+
+    size_t end = pl->len;
+    if( pl->len - pl->at > mj_piece ) {
+        const char *nl = memchr( pl->p + pl->at + mj_piece, '\n',
+                                 pl->len - pl->at - mj_piece );
+        if( nl )
+            end = nl - pl->p + 1;
+    }
+    *pc = (piece){ .p = pl->p + pl->at, .len = end - pl->at };
+    pl->at = end;
+    return true;
+}
+
+/** Take the next piece of the input at \a pl, once its slot is free,
+ *  and return it; or a null, if there are no more, or we're to stop.
+ *  The documents and lines in it are counted before it's returned. */
+static piece *
+take( pool *pl )
+{
+    pthread_mutex_lock( &pl->rmu );
+    pthread_mutex_lock( &pl->mu );
+
+    size_t k = pl->taken;
+    piece *pc = &pl->pc[ k % pl->npc ];
+    while( !pl->stop && !pl->last && pc->state != ps_free )
+        pthread_cond_wait( &pl->cv, &pl->mu );
+    bool go = !pl->stop && !pl->last;
+    pthread_mutex_unlock( &pl->mu );
+
+    piece next;
+    if( go )
+        go = pl->p ? mappiece( pl, &next ) : readpiece( pl, &next );
+
+    pthread_mutex_lock( &pl->mu );
+    if( go ) {
+        *pc = next;
+        pc->k = k;
+        pc->state = ps_taken;
+        ++pl->taken;
+    } else
+        pl->last = true;
+    pthread_cond_broadcast( &pl->cv );
+    pthread_mutex_unlock( &pl->mu );
+    pthread_mutex_unlock( &pl->rmu );
+
+    if( !go )
+        return 0;
+    pc->docs = jrcount( pc->p, pc->len );
+    pc->lines = newlines( pc->p, pc->len );
+    return pc;
+}
+
+/** Having counted the piece \a pc, place it and any others after it
+ *  that have been counted, and then wait for \a pc to be placed, if
+ *  it wasn't already; see pool. */
+static void
+place( pool *pl, piece *pc )
+{
+    pthread_mutex_lock( &pl->mu );
+    pc->state = ps_counted;
+    for( piece *q; ( q = &pl->pc[ pl->placed % pl->npc ] )->k == pl->placed
+                   && q->state == ps_counted; ++pl->placed ) {
+        q->n = pl->n;
+        q->line = pl->line;
+        pl->n += q->docs;
+        pl->line += q->lines;
+        q->state = ps_placed;
+    }
+    pthread_cond_broadcast( &pl->cv );
+    while( pc->state != ps_placed )
+        pthread_cond_wait( &pl->cv, &pl->mu );
+    pthread_mutex_unlock( &pl->mu );
+}
+
+/** Convert the documents in the piece \a pc into memory of its own,
+ *  just as series() would have converted them. Since the main thread
+ *  writes the beginning and end of the output, we write only the
+ *  documents; see #jw_part. */
+static void
+convert( pool *pl, piece *pc )
+{
+    const how *hw = pl->hw;
+
+    pc->out = (obuf){ .fd = -1 };
+    jreader *r = jropen_mem( pc->p, pc->len );
+    jrline( r, pc->line );
+    jrpath( r, hw->path );
+    jhandler *h = (*hw->opener)( &pc->out, hw->flags | jw_part );
+    pc->ok = records( r, h, hw, pc->n, pl->st ? &pc->st : 0 );
+    pc->closed = (*hw->closer)( h );
+    jrclose( r );
+
+    free( pc->buf );
+    pc->buf = 0;
+}
+
+/** The life of each thread converting a series with -j. */
+static void *
+worker( void *arg )
+{
+    pool *pl = arg;
+    piece *pc;
+
+    while(( pc = take( pl ))) {
+        place( pl, pc );
+        convert( pl, pc );
+
+        pthread_mutex_lock( &pl->mu );
+        pc->state = ps_done;
+        pthread_cond_broadcast( &pl->cv );
+        pthread_mutex_unlock( &pl->mu );
+    }
+    return 0;
+}
+
+/** Just like series(), but the documents are converted by \a threads
+ *  threads at once, and written to \a out in their original order; see
+ *  pool. This only works when no document spans more than one line,
+ *  as in NDJSON. When the last document written was left half done,
+ *  \a h is left alone, so that the output stays unterminated, just as
+ *  it would be without threads; otherwise, \a h is closed. Anything
+ *  counted in \a st is added up over all the threads, times included,
+ *  so they can add up to more than the time the whole thing took. */
+static bool
+pseries( FILE *fp, obuf *out, jhandler *h, const how *hw, unsigned threads,
+         stats *st )
+{
+    mapping mp;
+    bool mapped = getin( fp, &mp, st );
+    pool pl = (pool){
+        .hw = hw, .st = st, .fd = fileno( fp ), .p = mapped ? mp.p : 0,
+        .len = mapped ? mp.len : 0, .npc = threads * mj_ahead,
+        .line = 1, .n = 1
+    };
+    pthread_t *tid = emalloc( threads * sizeof( *tid ));
+
+    pl.pc = emalloc( pl.npc * sizeof( *pl.pc ));
+    for( size_t i = 0; i < pl.npc; ++i )
+        pl.pc[i] = (piece){ .k = (size_t)-1, .state = ps_free };
+    pthread_mutex_init( &pl.rmu, 0 );
+    pthread_mutex_init( &pl.mu, 0 );
+    pthread_cond_init( &pl.cv, 0 );
+
+    scaninit();
+    unsigned started = 0;
+    for( ; started < threads; ++started )
+        if(( errno = pthread_create( &tid[ started ], 0, worker, &pl ))) {
+            err( "cannot start a thread: %s", strerror( errno ));
+            break;
+        }
+
+    /* Write each piece as soon as it's done, in order, until there
+     * are no more, or one of them went bad. */
+
+    bool ok = started > 0, closed = true;
+    pthread_mutex_lock( &pl.mu );
+    for( size_t k = 0; ok && closed; ++k ) {
+        piece *pc = &pl.pc[ k % pl.npc ];
+        while( !( pc->k == k && pc->state == ps_done )
+               && !( pl.last && k == pl.taken ))
+            pthread_cond_wait( &pl.cv, &pl.mu );
+        if( pc->k != k || pc->state != ps_done )
+            break;
+
+        /* A piece of blank lines, or whose first document was bad,
+         * has nothing to write, and no buffer to write it from. */
+
+        if( pc->out.len ) {
+            pthread_mutex_unlock( &pl.mu );
+            obputn( out, pc->out.p, pc->out.len );
+            pthread_mutex_lock( &pl.mu );
+        }
+
+        obclear( &pc->out );
+        if( st )
+            stadd( st, &pc->st );
+        ok = pc->ok;
+        closed = pc->closed;
+        pc->state = ps_free;
+        pthread_cond_broadcast( &pl.cv );
+    }
+    pl.stop = true;
+    pthread_cond_broadcast( &pl.cv );
+    pthread_mutex_unlock( &pl.mu );
+
+    while( started )
+        pthread_join( tid[ --started ], 0 );
+    for( size_t i = 0; i < pl.npc; ++i ) {
+        free( pl.pc[i].buf );
+        obclear( &pl.pc[i].out );
+    }
+    free( pl.pc );
+    free( pl.rest );
+    free( tid );
+    pthread_cond_destroy( &pl.cv );
+    pthread_mutex_destroy( &pl.mu );
+    pthread_mutex_destroy( &pl.rmu );
+    if( mapped ) {
+        if( st )
+            st->in = mp.len;
+        release( &mp );
+    }
+
+    if( closed )
+        ok = (*hw->closer)( h ) && ok;
+    return ok;
+}
+
+/** Finish up a conversion that began at \a start and wrote to \a out,
+ *  filling in the rest of \a st and reporting it, if we're keeping
+ *  statistics at all. Returns the exit status, given whether the
+ *  conversion was \a ok. */
+static int
+finish( bool ok, const obuf *out, stats *st, double start )
+{
+    if( st ) {
+        st->out = out->written;
+        st->total = stnow() - start;
+        streport( stderr, st );
+    }
+    return ok ? 0 : 1;
+}
+
 int
 main( int argc, char *argv[] )
 {
     /* output is our driver, pointing to the routine indicated by the
      * command line option for different output languages. XML and
-     * ksh93 are supported at present. */
+     * ksh93 are supported at present. When streaming, or converting a
+     * series, the driver is instead the set of routines in hw, which
+     * wrap around the parse. */
 
-    bool (*output)( FILE *, const jvalue * ) = writexml;
+    bool (*output)( obuf *, const jvalue *, unsigned, unsigned ) = writexml_mt;
+    how hw = (how){ .opener = xmlopen, .writer = xmlwrite,
+                    .closer = xmlclose };
+    bool many = false, counting = false;
+    unsigned long threads = 1;
+    char *end;
     int opt;
 
-    while(( opt = getopt( argc, argv, "Akx" )) != EOF )
+    while(( opt = getopt( argc, argv, "Aj:km:np:Ssx" )) != EOF )
         switch( opt ) {
 	case 'A':
-	    usemap = true;
+	    hw.flags |= jw_assoc;
 	    break;
+        case 'j':
+            threads = strtoul( optarg, &end, 10 );
+            if( *end || !*optarg || threads < 1 || threads > mj_max ) {
+                err( "-j needs a number of threads from 1 to %d", mj_max );
+                return 2;
+            }
+            break;
         case 'k':
-            output = writeksh;
+            output = writeksh_mt;
+            hw.opener = kshopen;
+            hw.writer = kshwrite;
+            hw.closer = kshclose;
+            break;
+        case 'm':
+            hw.member = optarg;
+            break;
+        case 'n':
+            many = true;
+            break;
+        case 'p':
+            hw.path = optarg;
+            if( *optarg && *optarg != '/' ) {
+                err( "-p needs a path that begins with a slash" );
+                return 2;
+            }
+            break;
+        case 'S':
+            counting = true;
+            break;
+        case 's':
+            hw.streaming = true;
             break;
         case 'x':
-            output = writexml;
+            output = writexml_mt;
+            hw.opener = xmlopen;
+            hw.writer = xmlwrite;
+            hw.closer = xmlclose;
             break;
         default:
             fputs( usage, stderr );
@@ -43,19 +695,78 @@ main( int argc, char *argv[] )
         err( "too many arguments" );
         return 2;
     }
+    if( hw.member && ( !many || hw.streaming )) {
+        err( "-m needs -n, and can't be used with -s" );
+        return 2;
+    }
+    if( threads > 1 && !many && hw.streaming ) {
+        err( "-j can't be used with -s, unless with -n" );
+        return 2;
+    }
+    hw.label = argc > 0 ? argv[0] : "foobar";
+
+    /* With -S, everything we count goes into st; otherwise, st is a
+     * null, and nothing is counted or timed at all. */
+
+    stats sts = (stats){ 0 }, *st = counting ? &sts : 0;
+    double start = st ? stnow() : 0;
+
+    /* With a series of documents, each is converted in turn, as soon
+     * as it has been parsed (or while it's being parsed, if we're
+     * streaming). With more than one thread, they're converted a
+     * bunch at a time, but still written out in order. */
+
+    obuf out = (obuf){ .fd = STDOUT_FILENO };
+
+    if( many ) {
+        jhandler *h = (*hw.opener)( &out, hw.flags );
+        bool ok;
+        if( threads > 1 )
+            ok = pseries( stdin, &out, h, &hw, threads, st );
+        else {
+            ok = series( stdin, h, &hw, st );
+            ok = (*hw.closer)( h ) && ok;
+        }
+        ok = obclear( &out ) && ok;
+        return finish( ok, &out, st, start );
+    }
+
+    /* When streaming, the output is written as the JSON data is
+     * parsed, and there's no tree at all; to count what's in it, we
+     * tap the handler. */
+
+    if( hw.streaming ) {
+        jhandler *h = (*hw.opener)( &out, hw.flags );
+        sttap tp;
+        h->key( h, hw.label );
+        bool ok = events( stdin, hw.path, st ? sttapinit( &tp, st, h ) : h, st );
+        ok = (*hw.closer)( h ) && ok;
+        ok = obclear( &out ) && ok;
+        return finish( ok, &out, st, start );
+    }
 
     /* Okay, now that we know which output driver to use, pull in the
      * JSON data into a parse tree. If the parse was successful, label
      * it by setting its top value name to something from the command
-     * line. Print it out, and go home. */
+     * line. Print it out, with any big array or object in it spread
+     * over the threads, and go home. */
 
-    jvalue *j = jparse( stdin );
+    jvalue *j = parse( stdin, hw.path, st );
     if( !j )
-        return 1;
+        return finish( false, &out, st, start );
 
-    j->n = estrdup( argc > 0 ? argv[0] : "foobar" );
-    (*output)( stdout, j );
+    /* The tree outlives the write, so its strings are written from
+     * where they lie, and it's only released once they're out. */
+
+    jsetname( j, j, hw.label );
+    if( st )
+        stsurvey( st, j );
+    double t = st ? stnow() : 0;
+    (*output)( &out, j, hw.flags | jw_refs, threads );
+    bool ok = obclear( &out );
+    if( st )
+        st->write = stnow() - t;
     jdel( j );
 
-    return 0;
+    return finish( ok, &out, st, start );
 }
@@ -0,0 +1,235 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "sanity.h"
+#include "obuf.h"
+
+enum {
+    /** The size of a buffer that writes to a descriptor, and so the
+     *  size of most of its writes. Anything put into a buffer that's
+     *  at least this big is written straight from where it lies. */
+    ob_size = 64 * 1024,
+
+    /** The first size of a buffer kept in memory. */
+    ob_initial_size = 4096,
+
+    /** Runs shorter than this are copied by obref() anyway; it's
+     *  cheaper than another entry in a writev(2). */
+    ob_refmin = 256,
+
+    /** How many pieces a single writev(2) gathers up, at most. Every
+     *  system we care about allows at least 1024. */
+    ob_iovs = 64
+};
+
+/** A slab of spaces, from which obspaces() copies indentation in one
+ *  go, rather than a level at a time. */
+#define SP8 "        "
+#define SP64 SP8 SP8 SP8 SP8 SP8 SP8 SP8 SP8
+static const char spaces[] = SP64 SP64 SP64 SP64;
+#undef SP64
+#undef SP8
+
+/** Write the \a n bytes at \a p to the descriptor of \a ob, however
+ *  many calls that takes. Once a write has failed, nothing more is
+ *  written; we complain just the once. */
+static void
+drain( obuf *ob, const char *p, size_t n )
+{
+    while( n && !ob->failed ) {
+        ssize_t w = write( ob->fd, p, n );
+        if( w < 0 && errno == EINTR )
+            continue;
+        if( w < 0 ) {
+            err( "cannot write output: %s", strerror( errno ));
+            ob->failed = true;
+            break;
+        }
+        p += w;
+        n -= w;
+        ob->written += w;
+    }
+}
+
+/** Write out everything in the #iov of \a ob with as many writev(2)
+ *  calls as it takes, picking up where each one leaves off. Just like
+ *  drain(), once a write has failed, nothing more is written. */
+static void
+gather( obuf *ob )
+{
+    struct iovec *v = ob->iov;
+    int n = ob->niov;
+
+    while( n && !ob->failed ) {
+        ssize_t w = writev( ob->fd, v, n );
+        if( w < 0 && errno == EINTR )
+            continue;
+        if( w < 0 ) {
+            err( "cannot write output: %s", strerror( errno ));
+            ob->failed = true;
+            break;
+        }
+        ob->written += w;
+        for( ; n && (size_t)w >= v->iov_len; ++v, --n )
+            w -= v->iov_len;
+        if( n ) {
+            v->iov_base = (char *)v->iov_base + w;
+            v->iov_len -= w;
+        }
+    }
+    ob->niov = 0;
+}
+
+/** Add the bytes put into \a ob since the last of its #iov to the
+ *  end of them. */
+static void
+marknow( obuf *ob )
+{
+    if( ob->len > ob->mark ) {
+        ob->iov[ ob->niov++ ] = (struct iovec){
+            .iov_base = ob->p + ob->mark, .iov_len = ob->len - ob->mark
+        };
+        ob->mark = ob->len;
+    }
+}
+
+/** Put the \a n bytes at \a s into \a ob by reference: rather than
+ *  being copied, they're written from where they lie at the next
+ *  flush, so they must stay there until then. Short runs are copied
+ *  anyway, as is everything put into a buffer kept in memory. */
+void
+obref( obuf *ob, const char *s, size_t n )
+{
+    if( ob->fd < 0 || n < ob_refmin ) {
+        obputn( ob, s, n );
+        return;
+    }
+    if( !ob->iov )
+        ob->iov = emalloc( ob_iovs * sizeof( *ob->iov ));
+
+    /* Leave room for what's been put before this, this, and whatever
+     * is put after it before the flush. */
+
+    if( ob->niov + 3 > ob_iovs )
+        obflush( ob );
+    marknow( ob );
+    ob->iov[ ob->niov++ ] = (struct iovec){
+        .iov_base = (void *)s, .iov_len = n
+    };
+}
+
+/** Make room in \a ob for at least \a n more bytes. A buffer with a
+ *  descriptor is flushed to make room, and only grows if \a n is
+ *  bigger than the whole of it; a buffer kept in memory just grows. */
+void
+obgrow( obuf *ob, size_t n )
+{
+    if( ob->fd >= 0 ) {
+        if( !ob->p ) {
+            ob->p = emalloc( ob_size );
+            ob->sz = ob_size;
+        }
+        obflush( ob );
+        if( n <= ob->sz )
+            return;
+    }
+
+    size_t sz = ob->sz ? ob->sz : ob_initial_size;
+    while( sz - ob->len < n )
+        sz *= 2;
+    ob->p = erealloc( ob->p, sz );
+    ob->sz = sz;
+}
+
+/** The slow path of obputn(), for when the \a n bytes at \a s don't
+ *  fit in what's left of \a ob. */
+void
+obwrite( obuf *ob, const char *s, size_t n )
+{
+    if( ob->fd >= 0 && n >= ob_size ) {
+        obflush( ob );
+        drain( ob, s, n );
+        return;
+    }
+    obgrow( ob, n );
+    memcpy( ob->p + ob->len, s, n );
+    ob->len += n;
+}
+
+/** Write out everything waiting in \a ob, if it has a descriptor.
+ *  Returns false if any write to it has ever failed. */
+bool
+obflush( obuf *ob )
+{
+    if( ob->fd >= 0 && ob->niov ) {
+        marknow( ob );
+        gather( ob );
+        ob->len = ob->mark = 0;
+    } else if( ob->fd >= 0 && ob->len ) {
+        drain( ob, ob->p, ob->len );
+        ob->len = 0;
+    }
+    return !ob->failed;
+}
+
+/** Flush \a ob, and then release its memory, leaving it empty but
+ *  still valid, still writing to the same descriptor, and still
+ *  counting what's been written to it in #written. Returns
+ *  what obflush() did. A buffer kept in memory loses its contents,
+ *  so take them first. */
+bool
+obclear( obuf *ob )
+{
+    bool ok = obflush( ob );
+
+    free( ob->p );
+    free( ob->iov );
+    *ob = (obuf){ .fd = ob->fd, .written = ob->written };
+    return ok;
+}
+
+/** Put \a n spaces into \a ob. */
+void
+obspaces( obuf *ob, size_t n )
+{
+    while( n ) {
+        size_t k = n < sizeof( spaces ) - 1 ? n : sizeof( spaces ) - 1;
+        obputn( ob, spaces, k );
+        n -= k;
+    }
+}
+
+/** Put the result of formatting the arguments according to \a fmt
+ *  into \a ob, just as printf(3) would. This is for the odd thing
+ *  that's awkward to put any other way; it's much slower than the
+ *  rest. */
+void
+obprintf( obuf *ob, const char *fmt, ... )
+{
+    va_list ap;
+
+    if( ob->len == ob->sz )
+        obgrow( ob, 1 );
+    for( ;; ) {
+        size_t room = ob->sz - ob->len;
+        va_start( ap, fmt );
+        int n = vsnprintf( ob->p + ob->len, room, fmt, ap );
+        va_end( ap );
+
+        if( n < 0 )
+            return;
+        if( (size_t)n < room ) {
+            ob->len += n;
+            return;
+        }
+        obgrow( ob, n + 1 );
+    }
+}
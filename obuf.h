@@ -0,0 +1,123 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_obuf_h
+#define jsoncvt_obuf_h
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "fmt.h"
+
+/** An output buffer gathers up everything a writer has to say, and
+ *  hands it to the system in big write(2) calls. It's what the writers
+ *  use instead of stdio. A writer spends most of its time putting
+ *  out short strings and single characters, and stdio charges for
+ *  every one of those calls: a lock on the stream in a reentrant
+ *  build, and a format string to parse for anything printf-like.
+ *  Here, putting a byte is a compare and a store, and putting a run
+ *  of bytes is a compare and a memcpy(3).
+ *
+ *  Initialize a buffer with an open descriptor in #fd and zeroes
+ *  everywhere else; it writes to the descriptor whenever it fills up.
+ *  With an #fd of -1, it never writes anything at all, and grows to
+ *  hold everything put into it, which is left at #p for the taking.
+ *
+ *  Bytes that will stay where they are until the next flush, such as
+ *  the strings in a tree that outlives the write, needn't be copied
+ *  in at all. obref() just remembers where they are, and the flush
+ *  gathers them up along with everything else in one writev(2).
+ *
+ *  Expected usage is something like
+ *
+ *  1. Initialize a buffer as described above.
+ *
+ *  2. Use obputc(), obputn(), obputs(), and obindent() to add to it,
+ *  obputint() and obputreal() for numbers, obref() for long runs of
+ *  bytes that stay put, and obprintf() for the odd thing that needs
+ *  formatting.
+ *
+ *  3. Use obflush() to write out everything added so far.
+ *
+ *  4. Release the buffer's memory via obclear(), which flushes it
+ *  first, leaving it empty but still valid. */
+typedef struct obuf {
+    int fd;                     /**< Where it all goes, or -1 */
+    char *p;                    /**< What's waiting to go there */
+    size_t len;                 /**< How many bytes are at #p */
+    size_t sz;                  /**< How many bytes #p can hold */
+    bool failed;                /**< A write has failed */
+    struct iovec *iov;          /**< What's waiting, when obref() is used */
+    int niov;                   /**< How many of #iov are in use */
+    size_t mark;                /**< How much of #p is already in #iov */
+    size_t written;             /**< How many bytes have gone to #fd */
+} obuf;
+
+extern void obgrow( obuf *, size_t );
+extern void obwrite( obuf *, const char *, size_t );
+extern void obref( obuf *, const char *, size_t );
+extern bool obflush( obuf * );
+extern bool obclear( obuf * );
+extern void obspaces( obuf *, size_t );
+extern void obprintf( obuf *, const char *, ... );
+
+/** Put the byte \a c into \a ob. */
+static inline void
+obputc( obuf *ob, char c )
+{
+    if( ob->len == ob->sz )
+        obgrow( ob, 1 );
+    ob->p[ ob->len++ ] = c;
+}
+
+/** Put the \a n bytes at \a s into \a ob. Anything too big to bother
+ *  copying goes straight out, once what's ahead of it has. Nothing at
+ *  all is done for no bytes, since a fresh buffer has no memory yet,
+ *  and \a s may be a null. */
+static inline void
+obputn( obuf *ob, const char *s, size_t n )
+{
+    if( !n )
+        return;
+    if( n > ob->sz - ob->len ) {
+        obwrite( ob, s, n );
+        return;
+    }
+    memcpy( ob->p + ob->len, s, n );
+    ob->len += n;
+}
+
+/** Put the C string \a s into \a ob. */
+static inline void
+obputs( obuf *ob, const char *s )
+{
+    obputn( ob, s, strlen( s ));
+}
+
+/** Put the integer \a v into \a ob, formatted straight into place by
+ *  fmtint(). */
+static inline void
+obputint( obuf *ob, long long v )
+{
+    if( ob->sz - ob->len < fmt_int_size )
+        obgrow( ob, fmt_int_size );
+    ob->len += fmtint( ob->p + ob->len, v );
+}
+
+/** Put the real \a v into \a ob, formatted straight into place by
+ *  fmtreal(). */
+static inline void
+obputreal( obuf *ob, long double v )
+{
+    if( ob->sz - ob->len < fmt_real_size )
+        obgrow( ob, fmt_real_size );
+    ob->len += fmtreal( ob->p + ob->len, v );
+}
+
+/** Put the indentation for a nesting \a depth into \a ob: two spaces
+ *  for each level, zero being the outermost. */
+static inline void
+obindent( obuf *ob, unsigned depth )
+{
+    obspaces( ob, 2 * (size_t)depth );
+}
+
+#endif
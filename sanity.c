@@ -7,6 +7,15 @@
 #include <string.h>
 #include "sanity.h"
 
+#ifdef ALLOC_STATS
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#undef emalloc
+#undef erealloc
+#undef estrdup
+#endif
+
 /** Allocate some number of bytes from the system and return a pointer
  *  to them, or exit. */
 void *
@@ -70,3 +79,279 @@ die( int x, const char *msg, ... )
     va_end( ap );
     exit( x );
 }
+
+#ifdef ALLOC_STATS
+
+/* The accounting behind ALLOC_STATS. Each allocation made through
+ * acmalloc() and its friends, which sanity.h puts in place of
+ * emalloc() and its friends, is counted by the function that asked
+ * for it, and by its size. We also keep track of every block we've
+ * handed out, so that we know how much each erealloc() grew it by,
+ * and how many times over a block was grown; that's a chain. Blocks
+ * are freed with free(3), which we never see, so a block is only
+ * known to be gone when its address comes back to us; until then, it
+ * stays in the table. None of this is meant to be fast, only right;
+ * everything is under the one mutex. */
+
+enum {
+    /** Requests are counted in classes by size: 16 bytes or less,
+     *  then 32 or less, and so on, doubling, up to this many. */
+    ac_classes = 48,
+
+    /** How many different functions we keep count of. Any beyond
+     *  these are counted together. */
+    ac_sites = 127,
+
+    /** Chains this long or longer are counted together. */
+    ac_chains = 16
+};
+
+/** What we know of a block we've handed out. */
+typedef struct acblock {
+    const void *p;              /**< Where it is, or null */
+    size_t sz;                  /**< How big it is */
+    size_t chain;               /**< How many times it's been grown */
+} acblock;
+
+/** Everything counted for one function that allocates. */
+typedef struct acsite {
+    const char *fn;             /**< The function, or null */
+    size_t mallocs;             /**< Calls to emalloc() or estrdup() */
+    size_t reallocs;            /**< Calls to erealloc() */
+    size_t bytes;               /**< How many bytes were asked for */
+} acsite;
+
+/** What we count: everything that's been allocated, and how. */
+static struct {
+    pthread_mutex_t mu;         /**< Held for everything */
+    bool started;               /**< The report is set to go at exit */
+    size_t mallocs;             /**< Calls to emalloc() */
+    size_t reallocs;            /**< Calls to erealloc() */
+    size_t strdups;             /**< Calls to estrdup() */
+    size_t bytes;               /**< Bytes asked for by all of them */
+    size_t grew;                /**< Reallocs that grew a block */
+    size_t shrank;              /**< Reallocs that shrank a block */
+    size_t moved;               /**< Reallocs that moved a block */
+    size_t by15;                /**< Growth by 1.5 times or less */
+    size_t by2;                 /**< Growth by twice or less */
+    size_t bymore;              /**< Growth by more than that */
+    size_t cls[ ac_classes ];   /**< Requests by size class */
+    size_t chains[ ac_chains ]; /**< Blocks by how often they grew */
+    acsite site[ ac_sites + 1 ]; /**< By function, and the rest */
+    acblock *blk;               /**< The blocks, hashed by address */
+    size_t nblk;                /**< How many slots #blk has in use */
+    size_t szblk;               /**< How many slots it has */
+} ac = { .mu = PTHREAD_MUTEX_INITIALIZER };
+
+/** Returns the slot in the table where the block at \a p is, or would
+ *  be. There's always an empty slot, so this always ends. */
+static acblock *
+acslot( const void *p )
+{
+    size_t h = ( (uintptr_t)p >> 4 ) * 0x9e3779b97f4a7c15ull;
+
+    for( size_t i = h & ( ac.szblk - 1 );; i = ( i + 1 ) & ( ac.szblk - 1 ))
+        if( !ac.blk[i].p || ac.blk[i].p == p )
+            return &ac.blk[i];
+}
+
+/** Count the chain of the block in \a b, which is gone. */
+static void
+acend( const acblock *b )
+{
+    ++ac.chains[ b->chain < ac_chains ? b->chain : ac_chains - 1 ];
+}
+
+/** Remember the block at \a p, \a sz bytes long, which has been grown
+ *  \a chain times. Should a block have been there before, it's gone
+ *  now. Forgotten blocks are left in the table, with their chains
+ *  already counted, as tombstones; there's little point in reusing
+ *  their slots, since the table never shrinks anyway. */
+static void
+acput( const void *p, size_t sz, size_t chain )
+{
+    if( 2 * ( ac.nblk + 1 ) > ac.szblk ) {
+        acblock *old = ac.blk;
+        size_t n = ac.szblk;
+
+        ac.szblk = n ? 2 * n : 1024;
+        ac.blk = calloc( ac.szblk, sizeof( *ac.blk ));
+        if( !ac.blk )
+            die( 1, "unable to keep count of allocations" );
+        ac.nblk = 0;
+        for( size_t i = 0; i < n; ++i )
+            if( old[i].p && old[i].sz != (size_t)-1 ) {
+                *acslot( old[i].p ) = old[i];
+                ++ac.nblk;
+            }
+        free( old );
+    }
+
+    acblock *b = acslot( p );
+    if( !b->p )
+        ++ac.nblk;
+    else if( b->sz != (size_t)-1 )
+        acend( b );
+    *b = (acblock){ .p = p, .sz = sz, .chain = chain };
+}
+
+/** Returns the function \a fn's counts. */
+static acsite *
+acsite_of( const char *fn )
+{
+    for( int i = 0; i < ac_sites; ++i )
+        if( !ac.site[i].fn || !strcmp( ac.site[i].fn, fn )) {
+            ac.site[i].fn = fn;
+            return &ac.site[i];
+        }
+    return &ac.site[ ac_sites ];
+}
+
+/** Write everything we've counted to the standard error, a line for
+ *  each number, just like the report of -S. Blocks still in the table
+ *  have their chains counted now. */
+static void
+acreport( void )
+{
+    pthread_mutex_lock( &ac.mu );
+    for( size_t i = 0; i < ac.szblk; ++i )
+        if( ac.blk[i].p && ac.blk[i].sz != (size_t)-1 )
+            acend( &ac.blk[i] );
+
+    fprintf( stderr, "jsoncvt: alloc malloc_calls %zu\n", ac.mallocs );
+    fprintf( stderr, "jsoncvt: alloc realloc_calls %zu\n", ac.reallocs );
+    fprintf( stderr, "jsoncvt: alloc strdup_calls %zu\n", ac.strdups );
+    fprintf( stderr, "jsoncvt: alloc bytes %zu\n", ac.bytes );
+    fprintf( stderr, "jsoncvt: alloc realloc_grew %zu\n", ac.grew );
+    fprintf( stderr, "jsoncvt: alloc realloc_shrank %zu\n", ac.shrank );
+    fprintf( stderr, "jsoncvt: alloc realloc_moved %zu\n", ac.moved );
+    fprintf( stderr, "jsoncvt: alloc grew_1.5x %zu\n", ac.by15 );
+    fprintf( stderr, "jsoncvt: alloc grew_2x %zu\n", ac.by2 );
+    fprintf( stderr, "jsoncvt: alloc grew_more %zu\n", ac.bymore );
+    for( int c = 0; c < ac_classes; ++c )
+        if( ac.cls[c] )
+            fprintf( stderr, "jsoncvt: alloc size_le_%zu %zu\n",
+                     (size_t)16 << c, ac.cls[c] );
+    for( int c = 0; c < ac_chains; ++c )
+        if( ac.chains[c] )
+            fprintf( stderr, "jsoncvt: alloc chain_%d%s %zu\n", c,
+                     c == ac_chains - 1 ? "_up" : "", ac.chains[c] );
+    for( int i = 0; i <= ac_sites; ++i ) {
+        const acsite *st = &ac.site[i];
+        const char *fn = i < ac_sites ? st->fn : "others";
+        if( !fn || !( st->mallocs + st->reallocs ))
+            continue;
+        fprintf( stderr, "jsoncvt: alloc %s_mallocs %zu\n", fn, st->mallocs );
+        fprintf( stderr, "jsoncvt: alloc %s_reallocs %zu\n", fn,
+                 st->reallocs );
+        fprintf( stderr, "jsoncvt: alloc %s_bytes %zu\n", fn, st->bytes );
+    }
+    free( ac.blk );
+    ac.blk = 0;
+    ac.szblk = ac.nblk = 0;
+    pthread_mutex_unlock( &ac.mu );
+}
+
+/** Count a request for \a nb bytes, by \a fn, in its size class. */
+static acsite *
+account( size_t nb, const char *fn )
+{
+    int c = 0;
+
+    if( !ac.started ) {
+        atexit( acreport );
+        ac.started = true;
+    }
+    while( c < ac_classes - 1 && ( (size_t)16 << c ) < nb )
+        ++c;
+    ++ac.cls[c];
+    ac.bytes += nb;
+
+    acsite *st = acsite_of( fn );
+    st->bytes += nb;
+    return st;
+}
+
+/** Just like emalloc(), but counted, on behalf of \a fn. */
+void *
+acmalloc( size_t nb, const char *fn )
+{
+    void *p = emalloc( nb );
+
+    pthread_mutex_lock( &ac.mu );
+    ++ac.mallocs;
+    ++account( nb, fn )->mallocs;
+    acput( p, nb, 0 );
+    pthread_mutex_unlock( &ac.mu );
+    return p;
+}
+
+/** Just like erealloc(), but counted, on behalf of \a fn. A null \a
+ *  ptr starts a new block, just as emalloc() would. We look the block
+ *  up before it's reallocated, and hold on to the mutex while it is,
+ *  so that no other thread can be handed its old address in between
+ *  and confuse us. */
+void *
+acrealloc( void *ptr, size_t nb, const char *fn )
+{
+    pthread_mutex_lock( &ac.mu );
+    ++ac.reallocs;
+    ++account( nb, fn )->reallocs;
+
+    acblock *b = ptr && ac.szblk ? acslot( ptr ) : 0;
+    if( b && ( !b->p || b->sz == (size_t)-1 ))
+        b = 0;
+
+    void *p = erealloc( ptr, nb );
+    size_t chain = 0;
+
+    if( b ) {
+        if( nb > b->sz ) {
+            ++ac.grew;
+            chain = b->chain + 1;
+            if( 2 * nb <= 3 * b->sz )
+                ++ac.by15;
+            else if( nb <= 2 * b->sz )
+                ++ac.by2;
+            else
+                ++ac.bymore;
+        } else {
+            ++ac.shrank;
+            chain = b->chain;
+        }
+
+        /* A block that moved leaves a tombstone behind; its chain
+         * carries on where it went. */
+
+        if( p == b->p ) {
+            b->sz = nb;
+            b->chain = chain;
+            pthread_mutex_unlock( &ac.mu );
+            return p;
+        }
+        ++ac.moved;
+        b->sz = (size_t)-1;
+    }
+    acput( p, nb, chain );
+    pthread_mutex_unlock( &ac.mu );
+    return p;
+}
+
+/** Just like estrdup(), but counted, on behalf of \a fn. */
+char *
+acstrdup( const char *s, const char *fn )
+{
+    char *p = estrdup( s );
+
+    if( p ) {
+        size_t nb = strlen( s ) + 1;
+        pthread_mutex_lock( &ac.mu );
+        ++ac.strdups;
+        ++account( nb, fn )->mallocs;
+        acput( p, nb, 0 );
+        pthread_mutex_unlock( &ac.mu );
+    }
+    return p;
+}
+
+#endif
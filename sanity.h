@@ -19,4 +19,18 @@ extern char *estrdup( const char * );
 extern void err( const char *msg, ... );
 extern void die( int xit, const char *msg, ... );
 
+/* Built with ALLOC_STATS defined, every allocation made through the
+ * functions above is counted, along with the function that made it,
+ * and a report of it all is written to the standard error at exit;
+ * see sanity.c. Without it, none of this exists at all. */
+
+#ifdef ALLOC_STATS
+extern void *acmalloc( size_t, const char * );
+extern void *acrealloc( void *, size_t, const char * );
+extern char *acstrdup( const char *, const char * );
+#define emalloc( nb ) acmalloc( nb, __func__ )
+#define erealloc( ptr, nb ) acrealloc( ptr, nb, __func__ )
+#define estrdup( s ) acstrdup( s, __func__ )
+#endif
+
 #endif
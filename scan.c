@@ -0,0 +1,579 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "scan.h"
+
+/* The vectorized classifiers need GCC-style target attributes and
+ * run-time CPU detection; anywhere else, only the plain C version is
+ * built. */
+#if defined( __GNUC__ ) && defined( __x86_64__ )
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/** The raw classification of one 64 byte block; bit i of each mask
+ *  describes byte i of the block. */
+typedef struct masks {
+    uint64_t q;                 /**< Double quotes */
+    uint64_t bs;                /**< Backslashes */
+    uint64_t ws;                /**< JSON whitespace */
+    uint64_t op;                /**< Structural characters []{}:, */
+} masks;
+
+/** Returns the bits of all the bytes in a block that are escaped by a
+ *  backslash, given the bits of all its backslashes. A backslash
+ *  escapes the next byte only when it ends a run of odd length, so
+ *  we have to find where each run starts and how long it is, all
+ *  without looking at one byte at a time. Adding the start of a run
+ *  to the run itself carries a bit just past its end; starting on an
+ *  odd or even bit tells us which parity that end lands on. A run
+ *  might continue into the next block, which is what #oddbs is for. */
+static inline uint64_t
+escaped( scanner *s, uint64_t bs )
+{
+    const uint64_t even = 0x5555555555555555ULL;
+    uint64_t esc = s->oddbs;
+
+    bs &= ~esc;
+    uint64_t follows = bs << 1 | esc;
+    uint64_t oddstarts = bs & ~even & ~follows;
+    uint64_t evenseqs = oddstarts + bs;
+    s->oddbs = evenseqs < bs;
+    return ( even ^ ( evenseqs << 1 )) & follows;
+}
+
+/** Returns a mask of every byte from an opening quote up to (but not
+ *  including) its closing quote, given the bits of the unescaped
+ *  quotes in a block. This is a carry-less multiplication by all
+ *  ones, done here with shifts. */
+static inline uint64_t
+prefixxor( uint64_t x )
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/** Given the classification of a block, its unescaped \a quotes, and
+ *  the mask of bytes \a in strings, return the bits of the bytes that
+ *  begin tokens. Structural characters count, as long as they're not
+ *  in a string, and so do opening quotes; any other byte following
+ *  whitespace, a structural character, or a quote is the start of a
+ *  scalar. Closing quotes only helped find those, so they go. */
+static inline uint64_t
+tokens( scanner *s, const masks *m, uint64_t quotes, uint64_t in )
+{
+    s->instr = (uint64_t)( (int64_t)in >> 63 );
+
+    uint64_t tok = ( m->op & ~in ) | quotes;
+    uint64_t pred = tok | m->ws;
+    uint64_t follows = pred << 1 | s->pred;
+    s->pred = pred >> 63;
+
+    tok |= follows & ~m->ws & ~in;
+    return tok & ~( quotes & ~in );
+}
+
+/** Classify a block one byte at a time. This runs anywhere. */
+static void
+classify( const char *p, masks *m )
+{
+    *m = (masks){ 0 };
+    for( int i = 0; i < 64; ++i ) {
+        uint64_t b = (uint64_t)1 << i;
+        switch( p[i] ) {
+        case '"':
+            m->q |= b;
+            break;
+        case '\\':
+            m->bs |= b;
+            break;
+        case ' ': case '\t': case '\n': case '\r':
+            m->ws |= b;
+            break;
+        case '[': case ']': case '{': case '}': case ':': case ',':
+            m->op |= b;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/** The plain C scanner. */
+static void
+scanc( scanner *s, const char *p, size_t n, uint64_t *bits )
+{
+    masks m;
+
+    for( ; n >= 64; n -= 64, p += 64 ) {
+        classify( p, &m );
+        uint64_t quotes = m.q & ~escaped( s, m.bs );
+        uint64_t in = prefixxor( quotes ) ^ s->instr;
+        *bits++ = tokens( s, &m, quotes, in );
+    }
+}
+
+/** Returns true if \a c is a byte that ends a plain run in a string:
+ *  a quote, a backslash, or a control character. */
+static inline bool
+special( unsigned char c )
+{
+    return c == '"' || c == '\\' || c < 0x20;
+}
+
+/** The plain C string scanner. Rather than testing one byte at a
+ *  time, this tests eight at once, with the old trick for finding a
+ *  zero byte in a word; only when that says something's there do we
+ *  go back and find out exactly where. */
+static size_t
+scanstrc( const char *p, size_t n )
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    size_t i = 0;
+
+    for( ; i + 8 <= n; i += 8 ) {
+        uint64_t x, q, b;
+        memcpy( &x, p + i, sizeof( x ));
+        q = x ^ ( ones * '"' );
+        b = x ^ ( ones * '\\' );
+        if((( q - ones ) & ~q & highs ) || (( b - ones ) & ~b & highs )
+           || (( x - ones * 0x20 ) & ~x & highs ))
+            break;
+    }
+    for( ; i < n; ++i )
+        if( special( p[i] ))
+            return i;
+    return n;
+}
+
+/** Returns nonzero if any of the eight bytes in \a x is zero; the old
+ *  trick, which never misses one, though it may not say which. */
+static inline uint64_t
+haszero( uint64_t x )
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+
+    return ( x - ones ) & ~x & highs;
+}
+
+/** Returns true if \a c has to be written as an entity in XML. */
+static inline bool
+xmlspecial( unsigned char c )
+{
+    return c == '<' || c == '>' || c == '&' || c == '\'' || c == '"';
+}
+
+/** Returns true if \a c can't be written as is inside a ksh $'...'
+ *  string: a control character, anything outside of ASCII, a quote,
+ *  or a backslash. */
+static inline bool
+kshspecial( unsigned char c )
+{
+    return c < 0x20 || c >= 0x7f || c == '\'' || c == '\\';
+}
+
+/** The plain C XML scanner, eight bytes at a time just like
+ *  scanstrc(). Or'ing in a bit folds < onto > and & onto ', leaving
+ *  just three bytes to look for. */
+static size_t
+scanxmlc( const char *p, size_t n )
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    size_t i = 0;
+
+    for( ; i + 8 <= n; i += 8 ) {
+        uint64_t x;
+        memcpy( &x, p + i, sizeof( x ));
+        if( haszero(( x | ones * 2 ) ^ ( ones * '>' ))
+            || haszero(( x | ones ) ^ ( ones * '\'' ))
+            || haszero( x ^ ( ones * '"' )))
+            break;
+    }
+    for( ; i < n; ++i )
+        if( xmlspecial( p[i] ))
+            return i;
+    return n;
+}
+
+/** The plain C ksh scanner, eight bytes at a time just like
+ *  scanstrc(). Bytes outside of ASCII are simply the ones with their
+ *  high bit set. */
+static size_t
+scankshc( const char *p, size_t n )
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    size_t i = 0;
+
+    for( ; i + 8 <= n; i += 8 ) {
+        uint64_t x;
+        memcpy( &x, p + i, sizeof( x ));
+        if(( x & highs ) || (( x - ones * 0x20 ) & ~x & highs )
+           || haszero( x ^ ( ones * 0x7f )) || haszero( x ^ ( ones * '\'' ))
+           || haszero( x ^ ( ones * '\\' )))
+            break;
+    }
+    for( ; i < n; ++i )
+        if( kshspecial( p[i] ))
+            return i;
+    return n;
+}
+
+#ifdef SCAN_X86
+
+/** Classify a block sixteen bytes at a time with SSE2. Or'ing in 0x20
+ *  folds [ and ] onto { and }, saving a pair of comparisons. */
+__attribute__(( target( "sse2" )))
+static void
+classifysse2( const char *p, masks *m )
+{
+#define EQ( v, c ) \
+    (uint64_t)(uint16_t)_mm_movemask_epi8( _mm_cmpeq_epi8( v, _mm_set1_epi8( c )))
+
+    *m = (masks){ 0 };
+    for( int i = 0; i < 64; i += 16 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *)( p + i ));
+        __m128i f = _mm_or_si128( v, _mm_set1_epi8( 0x20 ));
+        m->q |= EQ( v, '"' ) << i;
+        m->bs |= EQ( v, '\\' ) << i;
+        m->ws |= ( EQ( v, ' ' ) | EQ( v, '\t' )
+                   | EQ( v, '\n' ) | EQ( v, '\r' )) << i;
+        m->op |= ( EQ( f, '{' ) | EQ( f, '}' )
+                   | EQ( v, ':' ) | EQ( v, ',' )) << i;
+    }
+#undef EQ
+}
+
+/** The SSE2 scanner. */
+__attribute__(( target( "sse2" )))
+static void
+scansse2( scanner *s, const char *p, size_t n, uint64_t *bits )
+{
+    masks m;
+
+    for( ; n >= 64; n -= 64, p += 64 ) {
+        classifysse2( p, &m );
+        uint64_t quotes = m.q & ~escaped( s, m.bs );
+        uint64_t in = prefixxor( quotes ) ^ s->instr;
+        *bits++ = tokens( s, &m, quotes, in );
+    }
+}
+
+/** The SSE2 string scanner. A byte is a control character when it's
+ *  unchanged by taking the unsigned minimum of it and 0x1f. */
+__attribute__(( target( "sse2" )))
+static size_t
+scanstrsse2( const char *p, size_t n )
+{
+    size_t i = 0;
+
+    for( ; i + 16 <= n; i += 16 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *)( p + i ));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '"' )),
+                          _mm_cmpeq_epi8( v, _mm_set1_epi8( '\\' ))),
+            _mm_cmpeq_epi8( _mm_min_epu8( v, _mm_set1_epi8( 0x1f )), v ));
+        unsigned b = (unsigned)_mm_movemask_epi8( m );
+        if( b )
+            return i + __builtin_ctz( b );
+    }
+    return i + scanstrc( p + i, n - i );
+}
+
+/** The SSE2 XML scanner, folding bytes just as scanxmlc() does. */
+__attribute__(( target( "sse2" )))
+static size_t
+scanxmlsse2( const char *p, size_t n )
+{
+    size_t i = 0;
+
+    for( ; i + 16 <= n; i += 16 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *)( p + i ));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8( _mm_or_si128( v, _mm_set1_epi8( 2 )),
+                                _mm_set1_epi8( '>' )),
+                _mm_cmpeq_epi8( _mm_or_si128( v, _mm_set1_epi8( 1 )),
+                                _mm_set1_epi8( '\'' ))),
+            _mm_cmpeq_epi8( v, _mm_set1_epi8( '"' )));
+        unsigned b = (unsigned)_mm_movemask_epi8( m );
+        if( b )
+            return i + __builtin_ctz( b );
+    }
+    return i + scanxmlc( p + i, n - i );
+}
+
+/** The SSE2 ksh scanner. Compared as signed bytes, everything outside
+ *  of ASCII is negative, so it's less than a space along with all the
+ *  control characters. */
+__attribute__(( target( "sse2" )))
+static size_t
+scankshsse2( const char *p, size_t n )
+{
+    size_t i = 0;
+
+    for( ; i + 16 <= n; i += 16 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *)( p + i ));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128( _mm_cmplt_epi8( v, _mm_set1_epi8( 0x20 )),
+                          _mm_cmpeq_epi8( v, _mm_set1_epi8( 0x7f ))),
+            _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '\'' )),
+                          _mm_cmpeq_epi8( v, _mm_set1_epi8( '\\' ))));
+        unsigned b = (unsigned)_mm_movemask_epi8( m );
+        if( b )
+            return i + __builtin_ctz( b );
+    }
+    return i + scankshc( p + i, n - i );
+}
+
+/** Just like classifysse2(), but thirty-two bytes at a time. */
+__attribute__(( target( "avx2" )))
+static void
+classifyavx2( const char *p, masks *m )
+{
+#define EQ( v, c ) \
+    (uint64_t)(uint32_t)_mm256_movemask_epi8( \
+        _mm256_cmpeq_epi8( v, _mm256_set1_epi8( c )))
+
+    *m = (masks){ 0 };
+    for( int i = 0; i < 64; i += 32 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)( p + i ));
+        __m256i f = _mm256_or_si256( v, _mm256_set1_epi8( 0x20 ));
+        m->q |= EQ( v, '"' ) << i;
+        m->bs |= EQ( v, '\\' ) << i;
+        m->ws |= ( EQ( v, ' ' ) | EQ( v, '\t' )
+                   | EQ( v, '\n' ) | EQ( v, '\r' )) << i;
+        m->op |= ( EQ( f, '{' ) | EQ( f, '}' )
+                   | EQ( v, ':' ) | EQ( v, ',' )) << i;
+    }
+#undef EQ
+}
+
+/** Just like prefixxor(), but with a real carry-less multiply. */
+__attribute__(( target( "pclmul" )))
+static inline uint64_t
+prefixxorclmul( uint64_t x )
+{
+    __m128i r = _mm_clmulepi64_si128( _mm_set_epi64x( 0, (long long)x ),
+                                      _mm_set1_epi8( (char)0xff ), 0 );
+    return (uint64_t)_mm_cvtsi128_si64( r );
+}
+
+/** The AVX2 scanner, which also leans on PCLMULQDQ. */
+__attribute__(( target( "avx2,pclmul" )))
+static void
+scanavx2( scanner *s, const char *p, size_t n, uint64_t *bits )
+{
+    masks m;
+
+    for( ; n >= 64; n -= 64, p += 64 ) {
+        classifyavx2( p, &m );
+        uint64_t quotes = m.q & ~escaped( s, m.bs );
+        uint64_t in = prefixxorclmul( quotes ) ^ s->instr;
+        *bits++ = tokens( s, &m, quotes, in );
+    }
+}
+
+/** Just like scanstrsse2(), but thirty-two bytes at a time. */
+__attribute__(( target( "avx2" )))
+static size_t
+scanstravx2( const char *p, size_t n )
+{
+    size_t i = 0;
+
+    for( ; i + 32 <= n; i += 32 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)( p + i ));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '"' )),
+                             _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\\' ))),
+            _mm256_cmpeq_epi8( _mm256_min_epu8( v, _mm256_set1_epi8( 0x1f )),
+                               v ));
+        unsigned b = (unsigned)_mm256_movemask_epi8( m );
+        if( b )
+            return i + __builtin_ctz( b );
+    }
+    return i + scanstrsse2( p + i, n - i );
+}
+
+/** Just like scanxmlsse2(), but thirty-two bytes at a time. */
+__attribute__(( target( "avx2" )))
+static size_t
+scanxmlavx2( const char *p, size_t n )
+{
+    size_t i = 0;
+
+    for( ; i + 32 <= n; i += 32 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)( p + i ));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8( _mm256_or_si256( v, _mm256_set1_epi8( 2 )),
+                                   _mm256_set1_epi8( '>' )),
+                _mm256_cmpeq_epi8( _mm256_or_si256( v, _mm256_set1_epi8( 1 )),
+                                   _mm256_set1_epi8( '\'' ))),
+            _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '"' )));
+        unsigned b = (unsigned)_mm256_movemask_epi8( m );
+        if( b )
+            return i + __builtin_ctz( b );
+    }
+    return i + scanxmlsse2( p + i, n - i );
+}
+
+/** Just like scankshsse2(), but thirty-two bytes at a time. AVX2 only
+ *  has a signed greater-than, so the comparison is turned around. */
+__attribute__(( target( "avx2" )))
+static size_t
+scankshavx2( const char *p, size_t n )
+{
+    size_t i = 0;
+
+    for( ; i + 32 <= n; i += 32 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)( p + i ));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256( _mm256_cmpgt_epi8( _mm256_set1_epi8( 0x20 ), v ),
+                             _mm256_cmpeq_epi8( v, _mm256_set1_epi8( 0x7f ))),
+            _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\'' )),
+                             _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\\' ))));
+        unsigned b = (unsigned)_mm256_movemask_epi8( m );
+        if( b )
+            return i + __builtin_ctz( b );
+    }
+    return i + scankshsse2( p + i, n - i );
+}
+
+#endif
+
+static void pickidx( scanner *, const char *, size_t, uint64_t * );
+static size_t pickstr( const char *, size_t );
+static size_t pickxml( const char *, size_t );
+static size_t pickksh( const char *, size_t );
+
+/** The scanners we settled on for this CPU. Until the first call to
+ *  any of them, these are stand-ins that figure out which ones to use
+ *  and replace themselves; see scaninit(). */
+static void (*idxfn)( scanner *, const char *, size_t, uint64_t * ) = pickidx;
+static size_t (*strfn)( const char *, size_t ) = pickstr;
+static size_t (*xmlfn)( const char *, size_t ) = pickxml;
+static size_t (*kshfn)( const char *, size_t ) = pickksh;
+
+/** Choose the best scanners this CPU can run. That happens all on its
+ *  own, the first time any scanner is called. A program that scans
+ *  on more than one thread at once should call this itself, before it
+ *  starts any of them, so that they don't all race to do it. */
+void
+scaninit( void )
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "pclmul" )) {
+        idxfn = scanavx2;
+        strfn = scanstravx2;
+        xmlfn = scanxmlavx2;
+        kshfn = scankshavx2;
+        return;
+    } else if( __builtin_cpu_supports( "sse2" )) {
+        idxfn = scansse2;
+        strfn = scanstrsse2;
+        xmlfn = scanxmlsse2;
+        kshfn = scankshsse2;
+        return;
+    }
+#endif
+    idxfn = scanc;
+    strfn = scanstrc;
+    xmlfn = scanxmlc;
+    kshfn = scankshc;
+}
+
+/** Stand-in for scanidx() until scaninit() has run. */
+static void
+pickidx( scanner *s, const char *p, size_t n, uint64_t *bits )
+{
+    scaninit();
+    idxfn( s, p, n, bits );
+}
+
+/** Stand-in for scanstr() until scaninit() has run. */
+static size_t
+pickstr( const char *p, size_t n )
+{
+    scaninit();
+    return strfn( p, n );
+}
+
+/** Stand-in for scanxml() until scaninit() has run. */
+static size_t
+pickxml( const char *p, size_t n )
+{
+    scaninit();
+    return xmlfn( p, n );
+}
+
+/** Stand-in for scanksh() until scaninit() has run. */
+static size_t
+pickksh( const char *p, size_t n )
+{
+    scaninit();
+    return kshfn( p, n );
+}
+
+/** Classify the \a n bytes at \a p, which must be a multiple of 64,
+ *  storing one 64-bit word of token bits per 64 bytes into \a bits.
+ *  See scanner for what the bits mean. */
+void
+scanidx( scanner *s, const char *p, size_t n, uint64_t *bits )
+{
+    idxfn( s, p, n, bits );
+}
+
+/** Returns the offset of the first byte among the \a n at \a p that
+ *  can't simply be copied out of a JSON string as is: a quote, a
+ *  backslash, or a control character. If there are none, \a n is
+ *  returned. */
+size_t
+scanstr( const char *p, size_t n )
+{
+    return strfn( p, n );
+}
+
+enum {
+    /** How many bytes scanxml() and scanksh() look at one at a time,
+     *  before bringing out the vectors. When what needs escaping is
+     *  thick on the ground, it's usually found in the first few bytes,
+     *  and that's quicker than setting up for the long haul. */
+    sc_probe = 8
+};
+
+/** Returns the offset of the first byte among the \a n at \a p that
+ *  has to be written as an entity in XML: one of <>&'". If there are
+ *  none, \a n is returned. */
+size_t
+scanxml( const char *p, size_t n )
+{
+    for( size_t i = 0; i < n && i < sc_probe; ++i )
+        if( xmlspecial( p[i] ))
+            return i;
+    return n <= sc_probe ? n : sc_probe + xmlfn( p + sc_probe, n - sc_probe );
+}
+
+/** Returns the offset of the first byte among the \a n at \a p that
+ *  has to be escaped inside a ksh $'...' string: a control character,
+ *  DEL, anything outside of ASCII, a quote, or a backslash. If there
+ *  are none, \a n is returned. */
+size_t
+scanksh( const char *p, size_t n )
+{
+    for( size_t i = 0; i < n && i < sc_probe; ++i )
+        if( kshspecial( p[i] ))
+            return i;
+    return n <= sc_probe ? n : sc_probe + kshfn( p + sc_probe, n - sc_probe );
+}
@@ -0,0 +1,46 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_scan_h
+#define jsoncvt_scan_h
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/** A scanner runs ahead of the JSON parser, classifying its input 64
+ *  bytes at a time and producing one bit per byte. A bit is set
+ *  wherever a token begins outside of a string: the structural
+ *  characters []{}:, and the opening quote of every string, plus the
+ *  first byte of every other scalar (numbers, true, false, and
+ *  null). Everything else, whitespace and the contents of strings
+ *  included, is clear. With that in hand, the parser can jump from
+ *  one token to the next instead of inspecting every byte in between.
+ *
+ *  Whether a byte is inside a string depends on everything before
+ *  it, so the input has to be fed through scanidx() in order, and
+ *  exactly once; what little state carries from one block to the next
+ *  lives here. Initialize a scanner to all zeroes before its first
+ *  block.
+ *
+ *  Where the hardware supports it, the classification is done with
+ *  SSE2 or AVX2, and string regions are found with a carry-less
+ *  multiply; a plain C version runs everywhere else. The choice is
+ *  made at run time, on the first call to scanidx() or scanstr(), or
+ *  by calling scaninit() beforehand.
+ *
+ *  scanstr() is its little sibling, used inside strings to find the
+ *  end of a run of bytes that can be copied out wholesale. The
+ *  writers have siblings of their own, scanxml() and scanksh(), which
+ *  find the next byte that has to be escaped in their output; they
+ *  only handle those few bytes themselves, and copy the rest. */
+typedef struct scanner {
+    uint64_t instr;             /**< All ones if we ended inside a string */
+    uint64_t oddbs;             /**< 1 if we ended on an odd run of \ */
+    uint64_t pred;              /**< 1 if our last byte can precede a scalar */
+} scanner;
+
+extern void scaninit( void );
+extern void scanidx( scanner *, const char *, size_t, uint64_t * );
+extern size_t scanstr( const char *, size_t );
+extern size_t scanxml( const char *, size_t );
+extern size_t scanksh( const char *, size_t );
+
+#endif
@@ -0,0 +1,158 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sanity.h"
+#include "obuf.h"
+#include "scan.h"
+#include "json.h"
+#include "split.h"
+
+enum {
+    /** How many elements go in each slice. A container with fewer
+     *  than twice this many isn't worth splitting. */
+    sp_grain = 1024,
+
+    /** How many slices each thread may have in hand, rendered or
+     *  not, beyond the one being written out. This is what bounds our
+     *  memory, should the output be slower than the threads. */
+    sp_ahead = 4
+};
+
+/** Where one slice is rendered, and waits to be written out. */
+typedef struct spslot {
+    size_t k;                   /**< Which slice is in it */
+    bool done;                  /**< It's been rendered */
+    obuf out;                   /**< What it was rendered to */
+} spslot;
+
+/** The state shared by the threads rendering a container. Slices are
+ *  taken in order, into a ring of slots; a thread can only take a
+ *  slice once the one that last used its slot has been written out.
+ *  Everything here is under #mu. */
+typedef struct sppool {
+    pthread_mutex_t mu;         /**< Held for everything */
+    pthread_cond_t cv;          /**< Something has changed */
+    const splitter *sp;         /**< How to render */
+    enum jtypes t;              /**< The type of the container */
+    jvalue *const *v;           /**< Its elements */
+    size_t n;                   /**< How many there are */
+    unsigned depth;             /**< The depth they're written at */
+    size_t slices;              /**< How many slices they make */
+    size_t next;                /**< The next slice to take */
+    size_t written;             /**< How many have been written out */
+    spslot *slot;               /**< The ring of slots */
+    size_t nslot;               /**< How many slots there are */
+} sppool;
+
+/** The life of each thread rendering slices. */
+static void *
+spthread( void *arg )
+{
+    sppool *pl = arg;
+    const splitter *sp = pl->sp;
+
+    pthread_mutex_lock( &pl->mu );
+    for( ;; ) {
+        while( pl->next < pl->slices && pl->next >= pl->written + pl->nslot )
+            pthread_cond_wait( &pl->cv, &pl->mu );
+        if( pl->next == pl->slices )
+            break;
+
+        size_t k = pl->next++;
+        spslot *s = &pl->slot[ k % pl->nslot ];
+        size_t from = k * sp_grain;
+        size_t n = pl->n - from < sp_grain ? pl->n - from : sp_grain;
+        pthread_mutex_unlock( &pl->mu );
+
+        s->out.len = 0;
+        (*sp->render)( &s->out, sp->flags, pl->t, pl->v + from, n,
+                       pl->depth );
+
+        pthread_mutex_lock( &pl->mu );
+        s->k = k;
+        s->done = true;
+        pthread_cond_broadcast( &pl->cv );
+    }
+    pthread_mutex_unlock( &pl->mu );
+    return 0;
+}
+
+/** Write the elements of \a j, an array or object whose elements are
+ *  written at \a depth, to \a ob, with the threads of \a sp; see
+ *  splitter. Returns false, having written nothing, if there aren't
+ *  enough elements to be worth it, or no threads could be had; the
+ *  caller should write them itself. Otherwise, it returns true once
+ *  they're all written. A thread that can't be had just leaves more
+ *  of the work to the others. */
+bool
+spwrite( const splitter *sp, obuf *ob, const jvalue *j, unsigned depth )
+{
+    size_t n = 0;
+
+    if( sp->threads <= 1 )
+        return false;
+    while( j->u.v[n] && n < 2 * sp_grain )
+        ++n;
+    if( n < 2 * sp_grain )
+        return false;
+    while( j->u.v[n] )
+        ++n;
+
+    sppool pl = (sppool){
+        .sp = sp, .t = jtype( j ), .v = j->u.v, .n = n, .depth = depth,
+        .slices = ( n + sp_grain - 1 ) / sp_grain,
+        .nslot = sp->threads * sp_ahead
+    };
+    pthread_t *tid = emalloc( sp->threads * sizeof( *tid ));
+    unsigned started = 0;
+
+    pl.slot = emalloc( pl.nslot * sizeof( *pl.slot ));
+    for( size_t i = 0; i < pl.nslot; ++i )
+        pl.slot[i] = (spslot){ .out = { .fd = -1 }};
+    pthread_mutex_init( &pl.mu, 0 );
+    pthread_cond_init( &pl.cv, 0 );
+
+    scaninit();
+    for( ; started < sp->threads; ++started )
+        if(( errno = pthread_create( &tid[ started ], 0, spthread, &pl ))) {
+            if( !started )
+                err( "cannot start a thread: %s", strerror( errno ));
+            break;
+        }
+
+    /* Write each slice as soon as it's rendered, in order. Since the
+     * slot is only reused once it's been flushed, the slice can go
+     * out from where it lies. */
+
+    pthread_mutex_lock( &pl.mu );
+    for( size_t k = 0; started && k < pl.slices; ++k ) {
+        spslot *s = &pl.slot[ k % pl.nslot ];
+        while( !( s->done && s->k == k ))
+            pthread_cond_wait( &pl.cv, &pl.mu );
+        pthread_mutex_unlock( &pl.mu );
+
+        obref( ob, s->out.p, s->out.len );
+        obflush( ob );
+
+        pthread_mutex_lock( &pl.mu );
+        s->done = false;
+        ++pl.written;
+        pthread_cond_broadcast( &pl.cv );
+    }
+    pthread_mutex_unlock( &pl.mu );
+
+    for( unsigned i = 0; i < started; ++i )
+        pthread_join( tid[i], 0 );
+    for( size_t i = 0; i < pl.nslot; ++i )
+        obclear( &pl.slot[i].out );
+    free( pl.slot );
+    free( tid );
+    pthread_cond_destroy( &pl.cv );
+    pthread_mutex_destroy( &pl.mu );
+    return started > 0;
+}
@@ -0,0 +1,36 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_split_h
+#define jsoncvt_split_h
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "json.h"
+#include "obuf.h"
+
+/** A splitter spreads the writing of a big array or object over a
+ *  few threads. A writer walking a tree on its own hands each array
+ *  or object it comes to over to spwrite() first. When the container
+ *  has enough elements to be worth it, spwrite() cuts them into
+ *  slices, and each thread renders slice after slice into a buffer
+ *  of its own, at the depth the elements would have been written at
+ *  anyway. The slices are written out in order as they're finished,
+ *  and the writer carries on after the last one; the output is just
+ *  as it would have been on one thread.
+ *
+ *  Only the first big container on any path down the tree is split;
+ *  a slice is rendered by a thread on its own, however big the
+ *  containers within it. */
+typedef struct splitter {
+    /** Renders the \a n elements at \a v, which are in a container of
+     *  type \a t, into \a ob, at \a depth, according to the jwflags
+     *  in \a flags. This is all a writer needs to provide. */
+    void (*render)( obuf *ob, unsigned flags, enum jtypes t,
+                    jvalue *const *v, size_t n, unsigned depth );
+
+    unsigned flags;             /**< Handed to #render */
+    unsigned threads;           /**< How many threads to render with */
+} splitter;
+
+extern bool spwrite( const splitter *, obuf *, const jvalue *, unsigned );
+
+#endif
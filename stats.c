@@ -0,0 +1,181 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "sanity.h"
+#include "ptrvec.h"
+#include "json.h"
+#include "stats.h"
+
+/** What each type is called in a report. */
+static const char *const names[] = {
+    [jnull] = "null", [jtrue] = "true", [jfalse] = "false",
+    [jstring] = "string", [jnumber] = "number", [jarray] = "array",
+    [jobject] = "object", [jint] = "int", [jreal] = "real"
+};
+
+/** Returns the current time, in nanoseconds. */
+double
+stnow( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Count the value \a j in \a st, but not anything inside it. */
+static void
+count( stats *st, const jvalue *j )
+{
+    enum jtypes t = jtype( j );
+
+    ++st->count[t];
+    if( t == jstring ) {
+        size_t n = strlen( j->u.s );
+        if( n > st->longest )
+            st->longest = n;
+    }
+}
+
+/** Count the document \a j and everything in it in \a st. Just like
+ *  the writers, we keep a stack of our own rather than calling
+ *  ourselves for each level; each entry is the next element to be
+ *  counted in one of the containers we're in. */
+void
+stsurvey( stats *st, const jvalue *j )
+{
+    ptrvec open = (ptrvec){ 0 };
+
+    ++st->docs;
+    count( st, j );
+    if( jtype( j ) == jarray || jtype( j ) == jobject )
+        pvadd( &open, j->u.v );
+    if( open.len > st->depth )
+        st->depth = open.len;
+
+    while( open.len ) {
+        jvalue **v = open.p[ open.len - 1 ];
+        if( !*v ) {
+            --open.len;
+            continue;
+        }
+        open.p[ open.len - 1 ] = v + 1;
+        count( st, *v );
+        if( jtype( *v ) == jarray || jtype( *v ) == jobject )
+            pvadd( &open, (*v)->u.v );
+        if( open.len > st->depth )
+            st->depth = open.len;
+    }
+    pvclear( &open );
+}
+
+/* The functions of a tap, each of which counts what it's handed and
+ * passes it on; see sttap. */
+
+static bool
+tbegin( jhandler *h, enum jtypes t )
+{
+    sttap *tp = (sttap *)h;
+
+    if( !tp->depth )
+        ++tp->st->docs;
+    ++tp->st->count[t];
+    if( ++tp->depth > tp->st->depth )
+        tp->st->depth = tp->depth;
+    return tp->next->begin( tp->next, t );
+}
+
+static bool
+tkey( jhandler *h, const char *n )
+{
+    sttap *tp = (sttap *)h;
+
+    return tp->next->key( tp->next, n );
+}
+
+static bool
+tscalar( jhandler *h, enum jtypes t, const char *s, size_t n )
+{
+    sttap *tp = (sttap *)h;
+
+    if( !tp->depth )
+        ++tp->st->docs;
+    ++tp->st->count[t];
+    if( t == jstring && n > tp->st->longest )
+        tp->st->longest = n;
+    return tp->next->scalar( tp->next, t, s, n );
+}
+
+static bool
+tend( jhandler *h, enum jtypes t )
+{
+    sttap *tp = (sttap *)h;
+
+    --tp->depth;
+    return tp->next->end( tp->next, t );
+}
+
+/** Set up \a tp to count everything on its way to \a next in \a st,
+ *  and return the handler to hand the parser in place of \a next. */
+jhandler *
+sttapinit( sttap *tp, stats *st, jhandler *next )
+{
+    *tp = (sttap){
+        .h = { .begin = tbegin, .key = tkey, .scalar = tscalar,
+               .end = tend },
+        .next = next, .st = st
+    };
+    return &tp->h;
+}
+
+/** Add what's counted in \a from to \a st; for a conversion split up
+ *  among threads, for example. */
+void
+stadd( stats *st, const stats *from )
+{
+    st->in += from->in;
+    st->out += from->out;
+    st->docs += from->docs;
+    st->parse += from->parse;
+    st->write += from->write;
+    st->total += from->total;
+    for( int t = 0; t <= jreal; ++t )
+        st->count[t] += from->count[t];
+    if( from->depth > st->depth )
+        st->depth = from->depth;
+    if( from->longest > st->longest )
+        st->longest = from->longest;
+}
+
+/** Write the report of \a st to \a fp, a line for each thing we've
+ *  counted, so that a script can pick out what it's after with
+ *  grep(1) or awk(1). The peak resident memory is that of the whole
+ *  process, as of now. Times that we didn't take, such as the time
+ *  spent parsing when the parse and the writing went on together,
+ *  aren't reported at all. */
+void
+streport( FILE *fp, const stats *st )
+{
+    struct rusage ru;
+
+    fprintf( fp, "jsoncvt: stat in_bytes %zu\n", st->in );
+    fprintf( fp, "jsoncvt: stat out_bytes %zu\n", st->out );
+    fprintf( fp, "jsoncvt: stat docs %zu\n", st->docs );
+    if( st->parse > 0 || st->write > 0 ) {
+        fprintf( fp, "jsoncvt: stat parse_ns %.0f\n", st->parse );
+        fprintf( fp, "jsoncvt: stat write_ns %.0f\n", st->write );
+    }
+    fprintf( fp, "jsoncvt: stat total_ns %.0f\n", st->total );
+    for( int t = 0; t <= jreal; ++t )
+        fprintf( fp, "jsoncvt: stat %s_count %zu\n", names[t],
+                 st->count[t] );
+    fprintf( fp, "jsoncvt: stat max_depth %zu\n", st->depth );
+    fprintf( fp, "jsoncvt: stat max_string %zu\n", st->longest );
+    if( !getrusage( RUSAGE_SELF, &ru ))
+        fprintf( fp, "jsoncvt: stat max_rss_kb %ld\n", (long)ru.ru_maxrss );
+}
@@ -0,0 +1,45 @@
+/* See one of the index files for license and other details. */
+#ifndef jsoncvt_stats_h
+#define jsoncvt_stats_h
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+#include "json.h"
+
+/** What -S reports about a conversion: how much went in and out, how
+ *  long it took, and what the documents were made of. Nothing is
+ *  counted unless someone asks; the parser and the writers know
+ *  nothing about any of this. The documents are surveyed with
+ *  stsurvey() once they've been parsed, or, when there's no tree at
+ *  all, counted on their way through by a tap (see sttap) in front of
+ *  the handler they're going to. */
+typedef struct stats {
+    size_t in;                  /**< Bytes of input */
+    size_t out;                 /**< Bytes of output */
+    size_t docs;                /**< How many documents there were */
+    double parse;               /**< Nanoseconds spent parsing trees */
+    double write;               /**< Nanoseconds spent writing them */
+    double total;               /**< Nanoseconds for the lot */
+    size_t count[ jreal + 1 ];  /**< How many values of each type */
+    size_t depth;               /**< How deep arrays and objects nest */
+    size_t longest;             /**< The longest string, in bytes */
+} stats;
+
+/** A tap counts everything handed to a jhandler on its way through,
+ *  as stsurvey() would count it in a tree, and then passes it on. Set
+ *  one up with sttapinit(), and hand the parser the jhandler that
+ *  returns. */
+typedef struct sttap {
+    jhandler h;                 /**< What the parser calls */
+    jhandler *next;             /**< What we pass everything on to */
+    stats *st;                  /**< What we count it all in */
+    size_t depth;               /**< How deep we are right now */
+} sttap;
+
+extern double stnow( void );
+extern void stsurvey( stats *, const jvalue * );
+extern jhandler *sttapinit( sttap *, stats *, jhandler * );
+extern void stadd( stats *, const stats * );
+extern void streport( FILE *, const stats * );
+
+#endif
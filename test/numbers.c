@@ -0,0 +1,72 @@
+/* See one of the index files for license and other details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sanity.h"
+#include "json.h"
+
+/* Checks the numbers that #jp_numbers decodes during the parse, from
+ * documents that are nothing but the one number. Each is copied into
+ * a buffer of exactly its own size, with no null after it, so that a
+ * build with -fsanitize=address catches anything that reads past the
+ * end; numbers whose exponent has no digits, such as "1e", are the
+ * ones most likely to. */
+
+/** A number, and what it ought to decode to. */
+typedef struct ncase {
+    const char *text;           /**< The document */
+    bool isint;                 /**< It should be a jint... */
+    long long i;                /**< ...with this value */
+    long double r;              /**< Or else a jreal with this one */
+} ncase;
+
+static const ncase cases[] = {
+    { "-12", true, -12, 0 },
+    { "2e-3", false, 0, 2e-3L },
+    { "1.5E+2", false, 0, 150 },
+    { "1e", false, 0, 1 },
+    { "1E", false, 0, 1 },
+    { "-1.5e", false, 0, -1.5L },
+    { "2e+", false, 0, 2 },
+    { "3e-", false, 0, 3 },
+    { "7.", false, 0, 7 }
+};
+
+/** Parse the case \a c, and returns true if it came out as it should,
+ *  complaining if it didn't. */
+static bool
+check( const ncase *c )
+{
+    size_t len = strlen( c->text );
+    char *buf = emalloc( len );
+    bool ok;
+
+    memcpy( buf, c->text, len );
+    jvalue *j = jparsef_mem( buf, len, jp_numbers );
+    if( !j )
+        ok = false;
+    else if( c->isint )
+        ok = jtype( j ) == jint && j->u.i == c->i;
+    else
+        ok = jtype( j ) == jreal && jrealval( j ) == c->r;
+    if( !ok )
+        err( "numbers: %s decoded wrong", c->text );
+    jdel( j );
+    free( buf );
+    return ok;
+}
+
+int
+main( void )
+{
+    int fails = 0;
+
+    for( size_t k = 0; k < sizeof( cases ) / sizeof( *cases ); ++k )
+        fails += !check( &cases[k] );
+    if( !fails )
+        puts( "numbers: all good" );
+    return fails != 0;
+}
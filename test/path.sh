@@ -0,0 +1,72 @@
+#!/bin/sh
+# See one of the index files for license and other details.
+#
+# Checks what -p picks out of documents written every which way:
+# compact, with a space after each separator, and pretty-printed over
+# several lines, so that whatever is skipped on the way to the path
+# has whitespace in all the places it can have it. Each case is a
+# path, a document, and the ksh93 that ought to come out; run it from
+# the top of the tree, after jsoncvt is built.
+
+jc=./jsoncvt
+fails=0
+
+# Convert the document $2 to ksh93 with -p $1, and compare the result
+# with $3; any further arguments go to jsoncvt as well.
+try() {
+    path=$1 doc=$2 want=$3
+    shift 3
+    got=$(printf '%s' "$doc" | $jc -k -p "$path" "$@" l 2>&1)
+    if [ "$got" != "$want" ]; then
+        printf 'FAIL -p %s %s\n  got:  %s\n  want: %s\n' \
+               "$path" "$doc" "$got" "$want"
+        fails=$((fails + 1))
+    fi
+}
+
+try /m '{"a":1,"m":2}' 'integer l=2'
+try /m '{"a":1, "m":2}' 'integer l=2'
+try /m '{"a": 1, "m": 2}' 'integer l=2'
+try /m '{ "a" : [1, {"x": 2}] ,
+  "m" : 2 }' 'integer l=2'
+try /m/r/1 '{
+  "a": [
+    1,
+    {
+      "x": 2
+    }
+  ],
+  "m": {
+    "q": 1,
+    "r": [
+      3,
+      4
+    ]
+  }
+}' 'integer l=4'
+try /a~1b/c~0 '{"x": {"c~": 0}, "a/b": {"y": 1,
+ "c~": "z"}}' "l=\$'z'"
+try /1/1 '[0, [1, 2] , 3]' 'integer l=2'
+try /m '{"a": 1, "b": 2}' \
+    'jsoncvt: nothing at /m on line 1 in JSON data'
+try /2 '[0,
+ 1]' 'jsoncvt: nothing at /2 on line 2 in JSON data'
+
+# With -n, the rest of each document has to be skipped, too.
+try /m/y '{"a": 1 , "m": {"z": 0 ,
+ "y": 5}}
+{ "q" : [ ] ,
+ "m" : { "y" : 6 } , "w": {"y": 7} }' 'integer l1=5
+integer l2=6' -n
+
+# A name right at the end of what one read(2) brings in has to be
+# compared before the next read overwrites it.
+got=$( ( printf '{"pad": "%s", "mm"' "$(printf '%01000d' 0)"; sleep 1
+         printf ': 7}' ) | $jc -k -p /mm l 2>&1)
+if [ "$got" != 'integer l=7' ]; then
+    printf 'FAIL -p /mm across reads\n  got:  %s\n' "$got"
+    fails=$((fails + 1))
+fi
+
+[ $fails -eq 0 ] && echo "path: all good"
+exit $fails
@@ -12,7 +12,8 @@ enum {
      * empty (zero bytes in size), and when they grow, this is their
      * first size. It's arbitrary, really, what you start with; we're
      * going with 16 because it's the cache line size on modern x86
-     * hardware; anything smaller would be pointless. */
+     * hardware; anything smaller would be pointless. Since that fits
+     * inside the twine, the first size costs no allocation at all. */
     tw_initial_size = 16
 };
 
@@ -44,7 +45,7 @@ twdel( twine *t )
 twine *
 twclear( twine *t )
 {
-    if( t->p )
+    if( t->p != t->in )
         free( t->p );
     *t = (twine){ 0 };
     return t;
@@ -61,13 +62,22 @@ twdup( const twine *t )
 }
 
 /** A wrapper for the common case at the end of working with twine.
- *  Return a C string ready for storage somewhere, and kill our own
- *  storage so that the next thing to come along can use our memory. */
+ *  Return a C string ready for storage somewhere, and leave the twine
+ *  empty. A string on the heap is simply handed over, trimmed to just
+ *  the space it needs; only a short one, kept inside the twine, has
+ *  to be copied out. */
 char *
 twfinal( twine *t )
 {
-    char *p = twdup( t );
-    twclear( t );
+    char *p;
+
+    if( !t->p || t->p == t->in )
+        p = twdup( t );
+    else if( t->sz > t->len + 1 )
+        p = erealloc( t->p, t->len + 1 );
+    else
+        p = t->p;
+    *t = (twine){ 0 };
     return p;
 }
 
@@ -84,9 +94,22 @@ twsize( twine *t, size_t nb )
     if( !nb )
         return twclear( t );
 
-    t->p = erealloc( t->p, t->sz = nb );
-    if( t->len >= t->sz ) {
-        t->len = t->sz - 1;
+    /* A string that's inside the twine stays there as long as it
+     * fits, and then moves out to the heap for good. */
+
+    if( t->p && t->p != t->in )
+        t->p = erealloc( t->p, t->sz = nb );
+    else if( nb <= tw_inline ) {
+        t->p = t->in;
+        t->sz = tw_inline;
+    } else {
+        char *p = emalloc( t->sz = nb );
+        if( t->p )
+            memcpy( p, t->in, t->len + 1 );
+        t->p = p;
+    }
+    if( t->len >= nb ) {
+        t->len = nb - 1;
         t->p[ t->len ] = 0;
     }
     return t;
@@ -201,6 +224,19 @@ twaddz( twine *t, const char *z )
     return t;
 }
 
+/** Like twaddz(), but this adds exactly \a nb bytes from \a z, which
+ *  needn't be null terminated. Handy for copying a whole run out of
+ *  some larger buffer at once. */
+twine *
+twaddn( twine *t, const char *z, size_t nb )
+{
+    twensure( t, t->len + nb + 1 );
+    memcpy( t->p + t->len, z, nb );
+    t->len += nb;
+    t->p[ t->len ] = 0;
+    return t;
+}
+
 /** Like twaddz(), but this adds another twine to us. */
 twine *
 twadd( twine *dst, const twine *src )
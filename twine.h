@@ -35,12 +35,27 @@
  *
  *  5. if you called twnew() earlier, call twdel() to free it. If you
  *  just want to free up the memory it uses but not the twine itself,
- *  call twclear(). twfinal() combines both twdup() and twclear().
+ *  call twclear(). twfinal() hands over the string as a C string of
+ *  its own, leaving the twine empty, just as twdup() and twclear()
+ *  would together, but without copying a long string.
+ *
+ *  A short string doesn't need the heap at all: it's kept in the
+ *  twine itself, at #in, and p points there. Only once it outgrows
+ *  that is a buffer allocated. Since p may point into the twine, a
+ *  twine that has anything in it mustn't be copied, only pointed to;
+ *  copy its string instead.
  */
+enum {
+    /** How long a string can be, counting its null, and still be
+     *  kept inside its twine. */
+    tw_inline = 24
+};
+
 typedef struct twine {
     char *p;               /**< null terminated C string data */
     size_t len;            /**< size of the string, not counting null */
     size_t sz;             /**< size of the underlying buffer */
+    char in[ tw_inline ];  /**< where p points, for a short string */
 } twine;
 
 extern twine *twnew();
@@ -57,6 +72,7 @@ extern twine *twsetz( twine *, const char * );
 
 extern twine *twadd( twine *, const twine * );
 extern twine *twaddc( twine *, char );
+extern twine *twaddn( twine *, const char *, size_t );
 extern twine *twaddu( twine *, uint32_t );
 extern twine *twaddz( twine *, const char * );
 
@@ -1,167 +1,413 @@
 /* See one of the index files for license and other details. */
 #define _POSIX_C_SOURCE 200112L
-#include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include "sanity.h"
+#include "twine.h"
+#include "obuf.h"
+#include "scan.h"
 #include "json.h"
+#include "split.h"
 #include "xml.h"
 
-static void indent( FILE *fp, unsigned depth );
-static bool xstr( FILE *fp, const char *s );
-static bool xvalue( FILE *fp, const jvalue *j, unsigned depth );
+/** One array or object that xvalue() is partway through writing. */
+typedef struct xframe {
+    const jvalue *j;            /**< The array or object */
+    jvalue **v;                 /**< Its next element */
+    unsigned depth;             /**< Its depth */
+} xframe;
+
+/** Where a tree is being written as XML, and how. Everything that
+ *  writes a tree is handed one of these, which also holds the stack
+ *  that xvalue() keeps in place of recursion, so that it's only
+ *  allocated once however many values are written. Zero one out
+ *  before use, and free #f after. */
+typedef struct xout {
+    obuf *ob;                   /**< Where the XML goes */
+    bool refs;                  /**< Strings can go by reference */
+    const splitter *sp;         /**< Where big containers go, if anywhere */
+    xframe *f;                  /**< The containers being written */
+    size_t sz;                  /**< How many of #f there's room for */
+} xout;
+
+static bool xstr( obuf *ob, const char *s, bool refs );
+static bool xvalue( xout *x, const jvalue *j, const char *n,
+                    unsigned depth );
+
+/** Print everything that comes before the first value. */
+static void
+xhead( obuf *ob )
+{
+    obputs( ob, "<?xml version='1.0' encoding='utf-8' ?>\n" );
+    obputs( ob, "<!DOCTYPE jsoncvt PUBLIC '-//KRZ//DTD jsoncvt 1.0.8//EN' 'http://www.cis.rit.edu/~krz/hacks/jsoncvt/jsoncvt.dtd'>\n" );
+    obputs( ob, "<jsoncvt>\n" );
+}
+
+/** Print everything that comes after the last value. */
+static void
+xtail( obuf *ob )
+{
+    obputs( ob, "</jsoncvt>\n" );
+}
 
 /** Writes the parsed JSON value tree out to the supplied file
  *  descriptor in XML, using the grammar described in the man page for
- *  jsoncvt. */
+ *  jsoncvt. Of the \a flags, only #jw_part and #jw_refs matter to
+ *  XML. */
+bool
+writexml( obuf *ob, const jvalue *j, unsigned flags )
+{
+    return writexml_mt( ob, j, flags, 1 );
+}
+
+/** Render the \a n elements at \a v, which are in a container of type
+ *  \a t, at \a depth; this is how a splitter renders a slice. */
+static void
+xslice( obuf *ob, unsigned flags, enum jtypes t, jvalue *const *v,
+        size_t n, unsigned depth )
+{
+    xout x = (xout){ .ob = ob, .refs = flags & jw_refs };
+
+    (void)t;
+    for( size_t i = 0; i < n; ++i )
+        xvalue( &x, v[i], jname( v[i] ), depth );
+    free( x.f );
+}
+
+/** Just like writexml(), but with up to \a threads threads rendering
+ *  the elements of a big array or object at once; see splitter. The
+ *  output is the same either way. */
 bool
-writexml( FILE *fp, const jvalue *j )
+writexml_mt( obuf *ob, const jvalue *j, unsigned flags, unsigned threads )
 {
-    fputs( "<?xml version='1.0' encoding='utf-8' ?>\n", fp );
-    fputs( "<!DOCTYPE jsoncvt PUBLIC '-//KRZ//DTD jsoncvt 1.0.8//EN' 'http://www.cis.rit.edu/~krz/hacks/jsoncvt/jsoncvt.dtd'>\n", fp );
-    fputs( "<jsoncvt>\n", fp );
-    int r = xvalue( fp, j, 1 );
-    fputs( "</jsoncvt>\n", fp );
+    splitter sp = (splitter){
+        .render = xslice, .flags = flags, .threads = threads
+    };
+    xout x = (xout){ .ob = ob, .refs = flags & jw_refs, .sp = &sp };
+
+    if( !( flags & jw_part ))
+        xhead( ob );
+    int r = xvalue( &x, j, jname( j ), 1 );
+    if( !( flags & jw_part ))
+        xtail( ob );
+    free( x.f );
     return r;
 }
 
-/** For a given jvalue, print its opening element. It may optionally
- *  contain a name attribute. */
+/** Print the opening element for a value of type \a t. It may
+ *  optionally contain a name attribute, when \a n isn't null. */
 static void
-xopen( FILE *fp, const jvalue *j, unsigned depth )
+xopen( obuf *ob, enum jtypes t, const char *n, unsigned depth )
 {
-    indent( fp, depth );
+    obindent( ob, depth );
 
-    switch( j->d ) {
+    switch( t ) {
     case jnull:
-        fputs( "<null", fp );
+        obputs( ob, "<null" );
         break;
     case jtrue:
-        fputs( "<true", fp );
+        obputs( ob, "<true" );
         break;
     case jfalse:
-        fputs( "<false", fp );
+        obputs( ob, "<false" );
         break;
     case jstring:
-        fputs( "<string", fp );
+        obputs( ob, "<string" );
         break;
     case jnumber: case jint: case jreal:
-        fputs( "<number", fp );
+        obputs( ob, "<number" );
         break;
     case jarray:
-        fputs( "<array", fp );
+        obputs( ob, "<array" );
         break;
     case jobject:
-        fputs( "<object", fp );
+        obputs( ob, "<object" );
         break;
     }
 
-    if( j->n ) {
-        fputs( " name='", fp );
-        xstr( fp, j->n );
-        fputc( '\'', fp );
+    if( n ) {
+        obputs( ob, " name='" );
+        xstr( ob, n, false );
+        obputc( ob, '\'' );
     }
 
-    switch( j->d ) {
+    switch( t ) {
     case jnull: case jtrue: case jfalse:
-        fputs( " />", fp );
+        obputs( ob, " />" );
         break;
     case jarray: case jobject:
-        fputs( ">\n", fp );
+        obputs( ob, ">\n" );
         break;
     default:
-        fputc( '>', fp );
+        obputc( ob, '>' );
         break;
     }
 }
 
-/** For a given jvalue, print its closing element. */
+/** Print the closing element for a value of type \a t. */
 static void
-xclose( FILE *fp, const jvalue *j, unsigned depth )
+xclose( obuf *ob, enum jtypes t, unsigned depth )
 {
-    switch( j->d ) {
+    switch( t ) {
     case jnull: case jtrue: case jfalse:
         break;
     case jarray:
-        indent( fp, depth );
-        fputs( "</array>", fp );
+        obindent( ob, depth );
+        obputs( ob, "</array>" );
         break;
     case jobject:
-        indent( fp, depth );
-        fputs( "</object>", fp );
+        obindent( ob, depth );
+        obputs( ob, "</object>" );
         break;
     case jstring:
-        fputs( "</string>", fp );
+        obputs( ob, "</string>" );
         break;
     case jnumber: case jint: case jreal:
-        fputs( "</number>", fp );
+        obputs( ob, "</number>" );
         break;
     }
-    fputc( '\n', fp );
+    obputc( ob, '\n' );
 }
 
-/** Given a JSON value, write its value to the supplied output stream. */
+/** Given a JSON value, write its value to the output of \a x, named
+ *  \a n. With #xout.refs, its strings can be written by reference, as
+ *  #jw_refs describes. The first big array or object it comes to is
+ *  handed to #xout.sp, if there is one.
+ *
+ *  Rather than calling ourselves for each element of an array or
+ *  object, we push the container onto the stack in \a x, and carry on
+ *  with its first element; once a value is written, the next one is
+ *  the next element of the container on top of the stack, and a
+ *  container with none left is closed and popped. */
 static bool
-xvalue( FILE *fp, const jvalue *j, unsigned depth )
+xvalue( xout *x, const jvalue *j, const char *n, unsigned depth )
 {
-    xopen( fp, j, depth );
+    obuf *ob = x->ob;
+    size_t len = 0;
 
-    switch( j->d ) {
-    case jnull: case jtrue: case jfalse:
-        break;
-    case jstring:
-        xstr( fp, j->u.s );
-        break;
-    case jnumber:
-        fputs( j->u.s, fp );
-        break;
-    case jint:
-        fprintf( fp, "%llu", j->u.i );
-        break;
-    case jreal:
-        fprintf( fp, "%Lg", j->u.r );
-        break;
-    case jarray: case jobject:
-        for( jvalue **jj = j->u.v; *jj; ++jj )
-            xvalue( fp, *jj, depth+1 );
-        break;
+    for( ;; ) {
+        bool pushed = false;
+
+        xopen( ob, jtype( j ), n, depth );
+
+        switch( jtype( j )) {
+        case jnull: case jtrue: case jfalse:
+            break;
+        case jstring:
+            xstr( ob, j->u.s, x->refs );
+            break;
+        case jnumber:
+            obputs( ob, j->u.s );
+            break;
+        case jint:
+            obputint( ob, j->u.i );
+            break;
+        case jreal:
+            obputreal( ob, jrealval( j ));
+            break;
+        case jarray: case jobject:
+            if( x->sp && spwrite( x->sp, ob, j, depth+1 ))
+                break;
+            if( len == x->sz ) {
+                x->sz = x->sz ? 2 * x->sz : 16;
+                x->f = erealloc( x->f, x->sz * sizeof( *x->f ));
+            }
+            x->f[ len++ ] = (xframe){ .j = j, .v = j->u.v, .depth = depth };
+            pushed = true;
+            break;
+        }
+
+        /* On to the next element of the innermost container, closing
+         * any that have run out. */
+
+        if( !pushed )
+            xclose( ob, jtype( j ), depth );
+        while( len && !*x->f[ len - 1 ].v ) {
+            xframe *f = &x->f[ --len ];
+            xclose( ob, jtype( f->j ), f->depth );
+        }
+        if( !len )
+            return true;
+
+        xframe *f = &x->f[ len - 1 ];
+        j = *f->v++;
+        n = jname( j );
+        depth = f->depth + 1;
+    }
+}
+
+/** Write the supplied string into the output buffer, escaping the
+ *  main five standard entities along the way. Because we know that
+ *  the JSON parser went out of its way to store text as UTF-8, we
+ *  don't actually have to do anything special here. Everything
+ *  between the entities is found by scanxml() and copied out a run at
+ *  a time; or, with \a refs, written from where it lies, when it's
+ *  long enough to be worth it. */
+static bool
+xstr( obuf *ob, const char *s, bool refs )
+{
+    size_t n = strlen( s );
+
+    for( ;; ) {
+        size_t k = scanxml( s, n );
+        if( refs )
+            obref( ob, s, k );
+        else
+            obputn( ob, s, k );
+        if( k == n )
+            return true;
+        s += k + 1;
+        n -= k + 1;
+
+        switch( s[-1] ) {
+        case '<':
+            obputs( ob, "&lt;" );
+            break;
+        case '>':
+            obputs( ob, "&gt;" );
+            break;
+        case '&':
+            obputs( ob, "&amp;" );
+            break;
+        case '\'':
+            obputs( ob, "&apos;" );
+            break;
+        case '"':
+            obputs( ob, "&quot;" );
+            break;
+        }
     }
+}
+
+/** The state of an XML conversion that runs straight off the events
+ *  coming out of the parser, rather than a tree. See xmlopen(). */
+typedef struct xstream {
+    jhandler h;                 /**< Our handler; must come first */
+    obuf *ob;                   /**< Where the XML goes */
+    const char *name;           /**< The name of the next value */
+    unsigned depth;             /**< How deeply nested we are */
+    unsigned flags;             /**< Our jwflags */
+    twine tw;                   /**< Scratch space for terminal values */
+    xframe *f;                  /**< The stack for xvalue(), kept */
+    size_t sz;                  /**< between trees; see xout */
+} xstream;
+
+/** A jhandler function, which opens the element for an array or an
+ *  object. */
+static bool
+xsbegin( jhandler *h, enum jtypes t )
+{
+    xstream *x = (xstream *)h;
 
-    xclose( fp, j, depth );
+    xopen( x->ob, t, x->name, ++x->depth );
+    x->name = 0;
+    return true;
+}
 
+/** A jhandler function, which notes the name of the next value. */
+static bool
+xskey( jhandler *h, const char *n )
+{
+    ( (xstream *)h )->name = n;
     return true;
 }
 
-/** Write the supplied string onto the outfile file stream, escaping
- *  the main five standard entities along the way. Because we know
- *  that the JSON parser went out of its way to store text as UTF-8,
- *  we don't actually have to do anything special here. Returns <0 if
- *  there's an error. */
+/** A jhandler function, which writes a terminal value in its entirety.
+ *  Strings are copied into a twine first; not only does that give us
+ *  the null that xstr() wants, but it stops the string at any null
+ *  inside it, just like writing the same string from a tree would. */
 static bool
-xstr( FILE *fp, const char *s )
-{
-    while( *s ) {
-        if( *s == '<' )
-            fputs( "&lt;", fp );
-        else if( *s == '>' )
-            fputs( "&gt;", fp );
-        else if( *s == '&' )
-            fputs( "&amp;", fp );
-        else if( *s == '\'' )
-            fputs( "&apos;", fp );
-        else if( *s == '"' )
-            fputs( "&quot;", fp );
+xsscalar( jhandler *h, enum jtypes t, const char *s, size_t n )
+{
+    xstream *x = (xstream *)h;
+
+    xopen( x->ob, t, x->name, x->depth + 1 );
+    x->name = 0;
+    if( t == jstring || t == jnumber ) {
+        x->tw.len = 0;
+        twaddn( &x->tw, s, n );
+        if( t == jstring )
+            xstr( x->ob, x->tw.p, false );
         else
-            fputc( *s, fp );
-        ++s;
+            obputs( x->ob, x->tw.p );
     }
+    xclose( x->ob, t, x->depth + 1 );
     return true;
 }
 
-/** Given a nesting depth (zero being the outermost element), emit
- *  some number of spaces that are appropriate for that depth. */
-static void
-indent( FILE *fp, unsigned depth )
+/** A jhandler function, which closes the element for an array or an
+ *  object. */
+static bool
+xsend( jhandler *h, enum jtypes t )
+{
+    xstream *x = (xstream *)h;
+
+    xclose( x->ob, t, x->depth-- );
+    return true;
+}
+
+/** Begin converting JSON to XML on \a ob while it is being parsed,
+ *  rather than afterwards. The handler returned is fed to jevents()
+ *  or jrevents(), which drive the conversion; the XML is exactly what
+ *  writexml() would write for the same document. Memory use depends
+ *  only on how deeply the document nests. The top value of each
+ *  document is named by a call to the handler's key function just
+ *  before it.
+ *
+ *  There can be any number of documents, one after another, each one
+ *  an element of the same <jsoncvt>. Trees can be mixed right in with
+ *  them, too; see xmlwrite(). Once all of them are through, hand the
+ *  handler to xmlclose(). With #jw_part among the \a flags, neither
+ *  the start nor the end of that <jsoncvt> is written, only the
+ *  documents in it. */
+jhandler *
+xmlopen( obuf *ob, unsigned flags )
+{
+    xstream *x = emalloc( sizeof( *x ));
+
+    *x = (xstream){
+        .h = { .begin = xsbegin, .key = xskey, .scalar = xsscalar,
+               .end = xsend },
+        .ob = ob,
+        .flags = flags
+    };
+    if( !( flags & jw_part ))
+        xhead( ob );
+    return &x->h;
+}
+
+/** Write the tree \a j as the next document in the conversion begun
+ *  by xmlopen(). It's named by the handler's key function, if that
+ *  was called, or else by its own name. */
+bool
+xmlwrite( jhandler *h, const jvalue *j )
 {
-    while( depth-- )
-        fputs( "  ", fp );
+    xstream *x = (xstream *)h;
+    xout o = (xout){ .ob = x->ob, .refs = x->flags & jw_refs,
+                     .f = x->f, .sz = x->sz };
+    bool ok = xvalue( &o, j, x->name ? x->name : jname( j ), 1 );
+
+    x->f = o.f;
+    x->sz = o.sz;
+
+    x->name = 0;
+    return ok;
+}
+
+/** Finish a conversion begun by xmlopen(), releasing \a h. Returns
+ *  false if the last document was never completed, in which case the
+ *  XML written so far is left unterminated. */
+bool
+xmlclose( jhandler *h )
+{
+    xstream *x = (xstream *)h;
+    bool ok = !x->depth;
+
+    if( ok && !( x->flags & jw_part ))
+        xtail( x->ob );
+    twclear( &x->tw );
+    free( x->f );
+    free( x );
+    return ok;
 }
@@ -2,10 +2,14 @@
 #ifndef jsoncvt_xml_h
 #define jsoncvt_xml_h
 #pragma once
-#include <stdio.h>
 #include <stdbool.h>
 #include "json.h"
+#include "obuf.h"
 
-extern bool writexml( FILE *, const jvalue * );
+extern bool writexml( obuf *, const jvalue *, unsigned );
+extern bool writexml_mt( obuf *, const jvalue *, unsigned, unsigned );
+extern jhandler *xmlopen( obuf *, unsigned );
+extern bool xmlwrite( jhandler *, const jvalue * );
+extern bool xmlclose( jhandler * );
 
 #endif